@@ -0,0 +1,301 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+/*
+ * Benchmarks the key handling path against stand-in xbmc servers.
+ *
+ * A UDP sink takes the event server's place on 9777 and a TCP sink the
+ * json-rpc server's on the given port, both on localhost, so xbmc must not
+ * be running. Synthetic key presses, each followed by its release,
+ * go through CecKeyPressCB just as if libcec had delivered them.
+ *
+ * The first pass sends each mapped key one at a time and waits for it to be
+ * handled and sent, and prints the per-key latency percentiles. The second pass
+ * pushes presses for each transport as fast as the dispatch queue takes
+ * them and reports the sustained rate.
+ */
+
+#include "keyhandler.h"
+#include "monotonic.h"
+#include <atomic>
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace CEC;
+using namespace std;
+
+#define LATENCY_PRESSES 200
+#define THROUGHPUT_PRESSES 20000
+#define HANDLE_TIMEOUT_MS 30000
+#define MAX_SINK_CLIENTS 4
+#define RELEASE_DURATION 100   // ms, like a short tap reported by libcec
+
+static atomic<bool>     stopSinks(false);
+static atomic<uint64_t> sinkDatagrams(0);
+static atomic<uint64_t> sinkBytes(0);
+static CKeyTable       *table;   // the default key map
+static CKeyContext     *bench;   // stands in for one adapter
+static CXbmcTarget     *target;  // its only xbmc: the sinks
+
+static int openSink(int type, int port)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+
+  int one = 1;
+  int sockfd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+  if (sockfd >= 0)
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (sockfd < 0 || bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || (type == SOCK_STREAM && listen(sockfd, 4) < 0))
+  {
+    cerr << "cannot listen on port " << port << ": " << strerror(errno) << endl;
+    exit(1);
+  }
+  return sockfd;
+}
+
+// stands in for both xbmc servers: counts datagrams and json-rpc bytes
+static void runSinks(int udp, int tcp)
+{
+  struct pollfd fds[2 + MAX_SINK_CLIENTS];
+  unsigned int count = 2;
+  fds[0].fd = udp;
+  fds[1].fd = tcp;
+  fds[0].events = fds[1].events = POLLIN;
+
+  char buf[65536];
+  while (!stopSinks)
+  {
+    if (poll(fds, count, 100) <= 0)
+      continue;
+
+    if (fds[0].revents & POLLIN)
+    {
+      while (recv(udp, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        sinkDatagrams++;
+    }
+
+    if ((fds[1].revents & POLLIN) && count < 2 + MAX_SINK_CLIENTS)
+    {
+      fds[count].fd = accept4(tcp, NULL, NULL, SOCK_CLOEXEC);
+      fds[count].events = POLLIN;
+      fds[count].revents = 0;
+      if (fds[count].fd >= 0)
+        count++;
+    }
+
+    for (unsigned int i = 2; i < count; i++)
+    {
+      if (!fds[i].revents)
+        continue;
+      ssize_t n = recv(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (n > 0)
+      {
+        sinkBytes += n;
+        continue;
+      }
+      close(fds[i].fd);
+      fds[i--] = fds[--count];
+    }
+  }
+
+  for (unsigned int i = 2; i < count; i++)
+    close(fds[i].fd);
+}
+
+// waits until the dispatcher has handled that many presses in all, which
+// means every request they make has been handed to the target
+static bool waitHandled(unsigned int handled)
+{
+  int64_t deadline = monotonicMs() + HANDLE_TIMEOUT_MS;
+  while (bench->dispatcher.Handled() + bench->dispatcher.Dropped() < handled)
+  {
+    if (monotonicMs() > deadline)
+      return false;
+    this_thread::yield();
+  }
+  return true;
+}
+
+// waits until the target has sent everything it was handed
+static bool waitSent()
+{
+  int64_t deadline = monotonicMs() + HANDLE_TIMEOUT_MS;
+  while (target->Backlog() > 0)
+  {
+    if (monotonicMs() > deadline)
+      return false;
+    this_thread::yield();
+  }
+  return true;
+}
+
+static cec_keypress makeKey(int keycode, int duration)
+{
+  cec_keypress key;
+  key.keycode = (cec_user_control_code)keycode;
+  key.duration = duration;
+  return key;
+}
+
+// one press at a time, so the latencies are not skewed by queueing
+static void measureLatency(ostream &report)
+{
+  for (int keycode = 0; keycode < 256; keycode++)
+  {
+    key_action_type type = (*table)[keycode].type;
+    if (type != ACT_EVENTSERVER && type != ACT_JSONRPC)
+      continue;
+
+    cec_keypress key = makeKey(keycode, 0);
+    cec_keypress release = makeKey(keycode, RELEASE_DURATION);
+    for (int i = 0; i < LATENCY_PRESSES; i++)
+    {
+      unsigned int handled = bench->dispatcher.Handled() + bench->dispatcher.Dropped() + 1;
+      CecKeyPressCB(bench, key);
+      if (!waitHandled(handled) || !waitSent())
+      {
+        report << "keycode " << keycode << " was not handled in time" << endl;
+        return;
+      }
+      CecKeyPressCB(bench, release);
+      if (!waitHandled(handled + 1))
+      {
+        report << "keycode " << keycode << " was not released in time" << endl;
+        return;
+      }
+    }
+  }
+
+  report << "per key latency over " << LATENCY_PRESSES << " presses each:" << endl;
+  dumpLatency(report);
+}
+
+// pushes as fast as the dispatch queue drains, without dropping anything
+static void measureThroughput(ostream &report, key_action_type type, unsigned int presses)
+{
+  int keycode = 0;
+  while (keycode < 256 && (*table)[keycode].type != type)
+    keycode++;
+  if (keycode == 256)
+    return;
+
+  cec_keypress key = makeKey(keycode, 0);
+  cec_keypress release = makeKey(keycode, RELEASE_DURATION);
+  unsigned int handled = bench->dispatcher.Handled() + bench->dispatcher.Dropped() + 2 * presses;
+  unsigned int dropped = bench->dispatcher.Dropped() + target->Dropped();
+  uint64_t datagrams = sinkDatagrams;
+  uint64_t bytes = sinkBytes;
+
+  int64_t start = monotonicNs();
+  for (unsigned int i = 0; i < presses; i++)
+  {
+    // every press and release may become a request for the target
+    while (bench->dispatcher.Depth() + target->Backlog() >= CXbmcTarget::QUEUE_SIZE - 2)
+      this_thread::yield();
+    CecKeyPressCB(bench, key);
+    CecKeyPressCB(bench, release);
+  }
+  bool done = waitHandled(handled) && waitSent();
+  int64_t elapsed = monotonicNs() - start;
+
+  report << "throughput " << key_action_name(type) << " (keycode " << keycode << "): ";
+  if (!done)
+  {
+    report << "not all presses were handled within " << HANDLE_TIMEOUT_MS << "ms" << endl;
+    return;
+  }
+
+  // give the sinks a moment to catch up before reading their counters
+  usleep(100000);
+  report << (uint64_t)(presses * 1e9 / elapsed) << " events/s over " << presses << " presses, "
+         << bench->dispatcher.Dropped() + target->Dropped() - dropped << " dropped, sink received ";
+  if (type == ACT_EVENTSERVER)
+    report << sinkDatagrams - datagrams << " datagrams" << endl;
+  else
+    report << sinkBytes - bytes << " bytes" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+  int rpcPort = DEFAULT_PORT;
+  unsigned int presses = THROUGHPUT_PRESSES;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      rpcPort = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      presses = atoi(argv[++i]);
+    else
+    {
+      cout << argv[0] << " [-p <port>] (json-rpc sink port) [-n <presses>] (presses per throughput run)" << endl;
+      return (strcmp(argv[i], "-h") == 0) ? 0 : 1;
+    }
+  }
+
+  int udp = openSink(SOCK_DGRAM, STD_PORT);
+  int tcp = openSink(SOCK_STREAM, rpcPort);
+  thread sinks(&runSinks, udp, tcp);
+
+  // the dispatcher takes ownership, but never lets go of it in here
+  xbmc_endpoint sink = { HOST, (unsigned int)rpcPort, STD_PORT };
+  bench = new CKeyContext("bench", "", vector<xbmc_endpoint>(1, sink));
+  target = bench->targets[0];
+  keyContexts.push_back(bench);
+  table = loadKeyTable("");
+  publishKeyTable(*bench, table);
+
+  // the handler logs every key press, keep that cost but not the output
+  ostream report(cout.rdbuf());
+  ofstream devnull("/dev/null");
+  cout.rdbuf(devnull.rdbuf());
+
+  if (!bench->Start())
+    return 1;
+
+  measureLatency(report);
+  measureThroughput(report, ACT_EVENTSERVER, presses);
+  measureThroughput(report, ACT_JSONRPC, presses);
+
+  keyContexts.clear();
+  delete bench;
+  cout.rdbuf(report.rdbuf());
+
+  stopSinks = true;
+  sinks.join();
+  close(udp);
+  close(tcp);
+  return 0;
+}
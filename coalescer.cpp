@@ -0,0 +1,63 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "coalescer.h"
+#include "monotonic.h"
+
+CCoalescer::CCoalescer(Apply apply, void *Context, unsigned int WindowMs)
+  : m_Apply(apply), m_Context(Context), m_Window(WindowMs), m_Pending(0), m_WindowEnd(0)
+{
+}
+
+void CCoalescer::Add(int steps)
+{
+  int64_t now = monotonicMs();
+  if (m_WindowEnd != 0 && now < m_WindowEnd)
+  {
+    m_Pending += steps;
+    return;
+  }
+
+  m_WindowEnd = now + m_Window;
+  m_Apply(m_Context, steps);
+}
+
+int CCoalescer::Flush()
+{
+  if (m_WindowEnd == 0)
+    return -1;
+
+  int64_t now = monotonicMs();
+  if (now < m_WindowEnd)
+    return (int)(m_WindowEnd - now);
+
+  if (m_Pending == 0)
+  {
+    m_WindowEnd = 0;
+    return -1;
+  }
+
+  int steps = m_Pending;
+  m_Pending = 0;
+  m_WindowEnd = now + m_Window;
+  m_Apply(m_Context, steps);
+  return m_Window;
+}
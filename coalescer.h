@@ -0,0 +1,57 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __COALESCER_H__
+#define __COALESCER_H__
+
+#include <stdint.h>
+
+/*
+ * Folds a burst of relative steps (e.g. repeated VOLUME_UP) into one.
+ *
+ * The first step is applied at once and opens a window. Steps arriving
+ * while the window is open are summed up; when it closes the sum is
+ * applied in one go and a new window opens, until a window passes without
+ * input. Holding a key thus costs one update per window, not per repeat.
+ * Not thread-safe, Add() and Flush() must be called from the same thread.
+ */
+class CCoalescer
+{
+public:
+  typedef void (*Apply)(void *Context, int steps);
+
+  CCoalescer(Apply apply, void *Context, unsigned int WindowMs);
+
+  void Add(int steps);
+
+  // applies collected steps once the window is over, returns the ms until
+  // Flush() needs to be called again or -1 if nothing is pending
+  int Flush();
+
+private:
+  Apply         m_Apply;
+  void         *m_Context;
+  unsigned int  m_Window;
+  int           m_Pending;
+  int64_t       m_WindowEnd;   // 0 while no window is open
+};
+
+#endif
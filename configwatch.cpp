@@ -0,0 +1,133 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "configwatch.h"
+#include <errno.h>
+#include <iostream>
+#include <stdint.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE)
+
+CConfigWatcher::CConfigWatcher()
+  : m_Reload(NULL), m_Inotify(-1), m_Timer(-1)
+{
+}
+
+CConfigWatcher::~CConfigWatcher()
+{
+  Close();
+}
+
+bool CConfigWatcher::Open(const string &Path, Reload reload)
+{
+  if (m_Inotify >= 0)
+    return true;
+
+  string dir = ".";
+  m_Name = Path;
+  size_t slash = Path.rfind('/');
+  if (slash != string::npos)
+  {
+    dir = slash == 0 ? "/" : Path.substr(0, slash);
+    m_Name = Path.substr(slash + 1);
+  }
+
+  m_Inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_Inotify < 0 || inotify_add_watch(m_Inotify, dir.c_str(), WATCH_MASK) < 0)
+  {
+    cout << "cannot watch " << dir << " for config changes: " << strerror(errno) << endl;
+    Close();
+    return false;
+  }
+
+  m_Timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (m_Timer < 0)
+  {
+    cout << "cannot create config watcher timer" << endl;
+    Close();
+    return false;
+  }
+
+  m_Path = Path;
+  m_Reload = reload;
+  return true;
+}
+
+void CConfigWatcher::Close()
+{
+  if (m_Timer >= 0)
+    close(m_Timer);
+  if (m_Inotify >= 0)
+    close(m_Inotify);
+  m_Timer = -1;
+  m_Inotify = -1;
+}
+
+// reads all pending events, true if one of them was about the config file
+bool CConfigWatcher::Changed()
+{
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+
+  for (;;)
+  {
+    ssize_t len = read(m_Inotify, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return changed;
+
+    for (char *p = buf; p < buf + len; )
+    {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      if (event->len && m_Name == event->name)
+        changed = true;
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+void CConfigWatcher::OnChange()
+{
+  if (!Changed())
+    return;
+
+  // (re)arm the one-shot timer, every further change pushes the reload back
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = SETTLE_MS / 1000;
+  spec.it_value.tv_nsec = (SETTLE_MS % 1000) * 1000000L;
+  timerfd_settime(m_Timer, 0, &spec, NULL);
+}
+
+void CConfigWatcher::OnSettled()
+{
+  uint64_t expirations;
+  if (read(m_Timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return;
+  m_Reload(m_Path);
+}
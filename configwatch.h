@@ -0,0 +1,65 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __CONFIGWATCH_H__
+#define __CONFIGWATCH_H__
+
+#include <string>
+
+/*
+ * Watches the config file with inotify and calls back when it changed.
+ *
+ * The directory is watched rather than the file, so editors that write a
+ * new file and rename it over the old one are noticed too. Changes are
+ * collected until the file has been left alone for SETTLE_MS, then the
+ * callback runs once. The owner polls Fd() and TimerFd() and calls
+ * OnChange() and OnSettled() when they become readable.
+ */
+class CConfigWatcher
+{
+public:
+  typedef void (*Reload)(const std::string &path);
+
+  CConfigWatcher();
+  ~CConfigWatcher();
+
+  bool Open(const std::string &Path, Reload reload);
+  void Close();
+
+  int Fd() const { return m_Inotify; }
+  int TimerFd() const { return m_Timer; }
+
+  void OnChange();
+  void OnSettled();
+
+  static const int SETTLE_MS = 100;
+
+private:
+  bool Changed();
+
+  std::string   m_Path;
+  std::string   m_Name;
+  Reload        m_Reload;
+  int           m_Inotify;
+  int           m_Timer;
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "dispatch.h"
+#include "monotonic.h"
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace CEC;
+using namespace std;
+
+CKeyDispatcher::CKeyDispatcher()
+  : m_Handler(NULL), m_Ticker(NULL), m_Context(NULL), m_WakeFd(-1), m_Stop(false), m_Dropped(0), m_Handled(0)
+{
+}
+
+CKeyDispatcher::~CKeyDispatcher()
+{
+  Stop();
+}
+
+bool CKeyDispatcher::Start(Handler handler, Ticker ticker, void *Context)
+{
+  if (m_WakeFd >= 0)
+    return true;
+
+  m_WakeFd = eventfd(0, EFD_CLOEXEC);
+  if (m_WakeFd < 0)
+  {
+    cout << "cannot create dispatcher eventfd" << endl;
+    return false;
+  }
+
+  m_Handler = handler;
+  m_Ticker = ticker;
+  m_Context = Context;
+  m_Stop = false;
+  m_Thread = thread(&CKeyDispatcher::Run, this);
+  return true;
+}
+
+void CKeyDispatcher::Stop()
+{
+  if (m_WakeFd < 0)
+    return;
+
+  m_Stop = true;
+  uint64_t one = 1;
+  write(m_WakeFd, &one, sizeof(one));
+  m_Thread.join();
+
+  close(m_WakeFd);
+  m_WakeFd = -1;
+}
+
+bool CKeyDispatcher::Push(const cec_keypress &key)
+{
+  queued_keypress event;
+  event.key = key;
+  event.queued = monotonicNs();
+
+  if (!m_Queue.Push(event))
+  {
+    m_Dropped.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+
+  uint64_t one = 1;
+  write(m_WakeFd, &one, sizeof(one));
+  return true;
+}
+
+void CKeyDispatcher::Wake()
+{
+  if (m_WakeFd < 0)
+    return;
+
+  uint64_t one = 1;
+  write(m_WakeFd, &one, sizeof(one));
+}
+
+void CKeyDispatcher::Run()
+{
+  queued_keypress event;
+  while (!m_Stop)
+  {
+    while (m_Queue.Pop(event))
+    {
+      m_Handler(m_Context, event);
+      m_Handled.fetch_add(1, memory_order_release);
+    }
+
+    int timeout = m_Ticker ? m_Ticker(m_Context) : -1;
+
+    struct pollfd pfd = { m_WakeFd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0 && errno != EINTR)
+      break;
+
+    uint64_t count;
+    if (ready > 0)
+      read(m_WakeFd, &count, sizeof(count));
+  }
+}
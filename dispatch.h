@@ -0,0 +1,89 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __DISPATCH_H__
+#define __DISPATCH_H__
+
+#include "libcec/cec.h"
+#include "spscqueue.h"
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+struct queued_keypress
+{
+  CEC::cec_keypress key;
+  int64_t           queued;   // monotonicNs() when libcec handed it to us
+};
+
+/*
+ * Decouples the libcec callback thread from everything that does I/O.
+ *
+ * Push() only copies the key press into a lock-free ring buffer and wakes
+ * the worker through an eventfd, so libcec gets its thread back right away.
+ * The worker thread pops the key presses in order and runs the handler.
+ * If the worker falls QUEUE_SIZE presses behind, new presses are dropped.
+ *
+ * The optional ticker also runs on the worker thread, after every batch of
+ * key presses and whenever the timeout it asked for has expired.
+ */
+class CKeyDispatcher
+{
+public:
+  typedef void (*Handler)(void *Context, const queued_keypress &event);
+  // returns the ms until it wants to run again, or -1 for no timeout
+  typedef int (*Ticker)(void *Context);
+
+  CKeyDispatcher();
+  ~CKeyDispatcher();
+
+  // both are called with Context
+  bool Start(Handler handler, Ticker ticker = NULL, void *Context = NULL);
+  void Stop();
+
+  // must only be called from the libcec callback thread
+  bool Push(const CEC::cec_keypress &key);
+
+  // runs the ticker soon, may be called from any thread
+  void Wake();
+
+  unsigned int Depth() const { return m_Queue.Depth(); }
+  unsigned int Dropped() const { return m_Dropped.load(std::memory_order_relaxed); }
+  // presses the handler has returned from, everything they queued is queued
+  unsigned int Handled() const { return m_Handled.load(std::memory_order_acquire); }
+
+  static const unsigned int QUEUE_SIZE = 64;
+
+private:
+  void Run();
+
+  CSpscQueue<queued_keypress, QUEUE_SIZE> m_Queue;
+  Handler                    m_Handler;
+  Ticker                     m_Ticker;
+  void                      *m_Context;
+  std::thread                m_Thread;
+  int                        m_WakeFd;
+  std::atomic<bool>          m_Stop;
+  std::atomic<unsigned int>  m_Dropped;
+  std::atomic<unsigned int>  m_Handled;
+};
+
+#endif
@@ -0,0 +1,393 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "eventserver.h"
+#include "monotonic.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+CEventServerSession::CEventServerSession(const char *Host, int Port, const char *DeviceName)
+  : m_Host(Host), m_Port(Port), m_DeviceName(DeviceName),
+    m_Connected(false), m_SendFailures(0), m_Reconnects(0)
+{
+  m_Socket = -1;
+  m_Client = NULL;
+  m_LastSend = 0;
+  m_LastAttempt = 0;
+  m_WasConnected = false;
+  m_Generation = 0;
+}
+
+CEventServerSession::~CEventServerSession()
+{
+  Disconnect();
+}
+
+bool CEventServerSession::Connect()
+{
+  lock_guard<mutex> lock(m_Lock);
+  return ConnectLocked();
+}
+
+void CEventServerSession::Disconnect()
+{
+  lock_guard<mutex> lock(m_Lock);
+  DisconnectLocked(true);
+}
+
+bool CEventServerSession::IsConnected()
+{
+  return m_Connected.load(memory_order_relaxed);
+}
+
+bool CEventServerSession::ConnectLocked()
+{
+  if (m_Client)
+    return true;
+
+  m_LastAttempt = monotonicSeconds();
+
+  int sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sockfd < 0)
+  {
+    cout << "error creating event server socket" << endl;
+    return false;
+  }
+
+  /* a connected UDP socket reports ICMP errors (xbmc not listening)
+     on the following send, which is how we notice a dead session. */
+  CAddress addr(m_Host.c_str(), m_Port);
+  if (connect(sockfd, addr.GetAddress(), sizeof(struct sockaddr_in)) < 0)
+  {
+    cout << "error connecting to event server " << m_Host << ":" << m_Port << endl;
+    close(sockfd);
+    return false;
+  }
+
+  m_Socket = sockfd;
+  m_Client = new CXBMCClient(m_Host.c_str(), m_Port, m_Socket);
+  if (!m_Client->SendHELO(m_DeviceName.c_str(), ICON_NONE))
+  {
+    DisconnectLocked(false);
+    return false;
+  }
+
+  m_LastSend = monotonicSeconds();
+  m_Generation++;
+  if (m_WasConnected)
+    m_Reconnects.fetch_add(1, memory_order_relaxed);
+  m_WasConnected = true;
+  m_Connected = true;
+  return true;
+}
+
+void CEventServerSession::DisconnectLocked(bool SayBye)
+{
+  m_Connected = false;
+  if (m_Client)
+  {
+    if (SayBye)
+      m_Client->SendBYE();
+    delete m_Client;
+    m_Client = NULL;
+  }
+  if (m_Socket >= 0)
+  {
+    close(m_Socket);
+    m_Socket = -1;
+  }
+}
+
+void CEventServerSession::Tick()
+{
+  lock_guard<mutex> lock(m_Lock);
+  time_t now = monotonicSeconds();
+
+  if (!m_Client)
+  {
+    if (now - m_LastAttempt >= RECONNECT_INTERVAL)
+      ConnectLocked();
+    return;
+  }
+
+  if (now - m_LastSend < PING_INTERVAL)
+    return;
+
+  if (m_Client->SendPING())
+    m_LastSend = now;
+  else
+    DisconnectLocked(false);
+}
+
+int CEventServerSession::Fd(unsigned int &Generation)
+{
+  lock_guard<mutex> lock(m_Lock);
+  Generation = m_Generation;
+  return m_Socket;
+}
+
+void CEventServerSession::Drain()
+{
+  lock_guard<mutex> lock(m_Lock);
+  if (m_Socket < 0)
+    return;
+
+  char buf[1024];
+  for (;;)
+  {
+    // xbmc does not normally answer, whatever it sends is ignored
+    ssize_t n = recv(m_Socket, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n >= 0 || errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return;
+
+    cout << "event server unreachable: " << strerror(errno) << endl;
+    DisconnectLocked(false);
+    m_LastAttempt = monotonicSeconds();
+    return;
+  }
+}
+
+bool CEventServerSession::Encode(CPacket &Packet, encoded_datagram &Out)
+{
+  int length = Packet.Encode(Out.data, sizeof(Out.data));
+  if (length < 0)
+  {
+    Out.length = 0;
+    return false;
+  }
+  Out.length = length;
+  return true;
+}
+
+bool CEventServerSession::EncodeButton(const char *Button, const char *DeviceMap, encoded_button &Out)
+{
+  CPacketBUTTON down(Button, DeviceMap, BTN_DOWN | BTN_USE_NAME | BTN_QUEUE);
+  CPacketBUTTON up(Button, DeviceMap, BTN_UP | BTN_USE_NAME | BTN_QUEUE | BTN_NO_REPEAT);
+  return Encode(down, Out.packets[0]) && Encode(up, Out.packets[1]);
+}
+
+bool CEventServerSession::EncodeHold(const char *Button, const char *DeviceMap, encoded_button &Out)
+{
+  CPacketBUTTON down(Button, DeviceMap, BTN_DOWN | BTN_USE_NAME);
+  CPacketBUTTON up(Button, DeviceMap, BTN_UP | BTN_USE_NAME);
+  return Encode(down, Out.packets[0]) && Encode(up, Out.packets[1]);
+}
+
+bool CEventServerSession::SendLocked(const encoded_datagram *Datagrams, unsigned int Count)
+{
+  struct mmsghdr msgs[MAX_BATCH];
+  struct iovec iov[MAX_BATCH];
+
+  while (Count > 0)
+  {
+    unsigned int batch = Count < MAX_BATCH ? Count : MAX_BATCH;
+    memset(msgs, 0, sizeof(struct mmsghdr) * batch);
+    for (unsigned int i = 0; i < batch; i++)
+    {
+      iov[i].iov_base = (void *)Datagrams[i].data;
+      iov[i].iov_len = Datagrams[i].length;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = sendmmsg(m_Socket, msgs, batch, 0);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return false;
+
+    Datagrams += sent;
+    Count -= sent;
+  }
+  return true;
+}
+
+bool CEventServerSession::Send(const encoded_datagram *Datagrams, unsigned int Count)
+{
+  lock_guard<mutex> lock(m_Lock);
+
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    if (!ConnectLocked())
+    {
+      m_SendFailures.fetch_add(1, memory_order_relaxed);
+      return false;
+    }
+
+    if (SendLocked(Datagrams, Count))
+    {
+      m_LastSend = monotonicSeconds();
+      return true;
+    }
+
+    cout << "event server send failed, reconnecting" << endl;
+    m_SendFailures.fetch_add(1, memory_order_relaxed);
+    DisconnectLocked(false);
+  }
+  return false;
+}
+
+bool CEventServerSession::LoadIcon(const char *Path, event_icon &Out)
+{
+  const char *extension = strrchr(Path, '.');
+  if (extension && strcasecmp(extension, ".png") == 0)
+    Out.type = ICON_PNG;
+  else if (extension && (strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0))
+    Out.type = ICON_JPEG;
+  else if (extension && strcasecmp(extension, ".gif") == 0)
+    Out.type = ICON_GIF;
+  else
+  {
+    cout << "unknown icon type: " << Path << endl;
+    return false;
+  }
+
+  int fd = open(Path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    cout << "cannot open icon " << Path << ": " << strerror(errno) << endl;
+    return false;
+  }
+
+  // the first packet also carries title and message
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0 ||
+      st.st_size > (off_t)(MAX_NOTIFICATION_PACKETS - 1) * MAX_PAYLOAD_SIZE)
+  {
+    cout << "icon " << Path << " is empty or too large" << endl;
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    cout << "cannot map icon " << Path << ": " << strerror(errno) << endl;
+    return false;
+  }
+
+  Out.data = (const char *)data;
+  Out.size = st.st_size;
+  return true;
+}
+
+bool CEventServerSession::SendNotificationLocked(const char *Title, const char *Message, const event_icon *Icon)
+{
+  // caption, message, icon type and four reserved bytes, then the icon
+  char text[MAX_PAYLOAD_SIZE];
+  size_t titleLength = strlen(Title);
+  size_t messageLength = strlen(Message);
+  size_t textLength = titleLength + messageLength + 7;
+  if (textLength > sizeof(text))
+    return false;
+  memcpy(text, Title, titleLength + 1);
+  memcpy(text + titleLength + 1, Message, messageLength + 1);
+  text[titleLength + messageLength + 2] = Icon ? Icon->type : ICON_NONE;
+  memset(text + titleLength + messageLength + 3, 0, 4);
+
+  size_t iconSize = Icon ? Icon->size : 0;
+  size_t total = textLength + iconSize;
+  unsigned int packets = (total + MAX_PAYLOAD_SIZE - 1) / MAX_PAYLOAD_SIZE;
+  if (packets > MAX_NOTIFICATION_PACKETS)
+    return false;
+
+  char headers[MAX_NOTIFICATION_PACKETS][HEADER_SIZE];
+  struct iovec iov[MAX_NOTIFICATION_PACKETS][3];
+  struct mmsghdr msgs[MAX_NOTIFICATION_PACKETS];
+  memset(msgs, 0, sizeof(struct mmsghdr) * packets);
+
+  size_t icon = 0;   // icon bytes placed so far
+  for (unsigned int i = 0; i < packets; i++)
+  {
+    size_t textPart = i == 0 ? textLength : 0;
+    size_t iconPart = min(iconSize - icon, (size_t)MAX_PAYLOAD_SIZE - textPart);
+    CPacket::EncodeHeader(PT_NOTIFICATION, packets, i + 1, textPart + iconPart, headers[i]);
+
+    int n = 0;
+    iov[i][n].iov_base = headers[i];
+    iov[i][n++].iov_len = HEADER_SIZE;
+    if (textPart)
+    {
+      iov[i][n].iov_base = text;
+      iov[i][n++].iov_len = textPart;
+    }
+    if (iconPart)
+    {
+      iov[i][n].iov_base = (void *)(Icon->data + icon);
+      iov[i][n++].iov_len = iconPart;
+      icon += iconPart;
+    }
+    msgs[i].msg_hdr.msg_iov = iov[i];
+    msgs[i].msg_hdr.msg_iovlen = n;
+  }
+
+  for (unsigned int done = 0; done < packets; )
+  {
+    int sent = sendmmsg(m_Socket, msgs + done, packets - done, 0);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return false;
+    done += sent;
+  }
+  return true;
+}
+
+bool CEventServerSession::SendNotification(const char *Title, const char *Message, const event_icon *Icon)
+{
+  // too long to send at all, no reason to reconnect
+  size_t text = strlen(Title) + strlen(Message) + 7;
+  size_t total = text + (Icon ? Icon->size : 0);
+  if (text > MAX_PAYLOAD_SIZE || total > MAX_NOTIFICATION_PACKETS * MAX_PAYLOAD_SIZE)
+    return false;
+
+  lock_guard<mutex> lock(m_Lock);
+
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    if (!ConnectLocked())
+    {
+      m_SendFailures.fetch_add(1, memory_order_relaxed);
+      return false;
+    }
+
+    if (SendNotificationLocked(Title, Message, Icon))
+    {
+      m_LastSend = monotonicSeconds();
+      return true;
+    }
+
+    cout << "event server notification failed, reconnecting" << endl;
+    m_SendFailures.fetch_add(1, memory_order_relaxed);
+    DisconnectLocked(false);
+  }
+  return false;
+}
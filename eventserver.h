@@ -0,0 +1,123 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __EVENTSERVER_H__
+#define __EVENTSERVER_H__
+
+#include "lib/xbmcclient.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#define DATAGRAM_CACHE_SIZE 128
+
+// a packet encoded once and sent verbatim afterwards
+struct encoded_datagram
+{
+  unsigned short length;
+  char           data[DATAGRAM_CACHE_SIZE];
+};
+
+// BTN_DOWN followed by BTN_UP of a named button
+struct encoded_button
+{
+  encoded_datagram packets[2];
+};
+
+// an icon file mapped once and sent as the tail of every notification
+struct event_icon
+{
+  unsigned short type;   // ICON_PNG, ICON_JPEG or ICON_GIF
+  const char    *data;
+  size_t         size;
+};
+
+/*
+ * A long-lived session with the xbmc event server.
+ *
+ * The UDP socket is opened once, registered with a HELO and kept alive
+ * with PINGs, so a key press only costs the sendto() of its packets. If a
+ * send fails (e.g. xbmc was restarted and the port is unreachable) the
+ * socket is dropped and the next send or Tick() opens a new one.
+ */
+class CEventServerSession
+{
+public:
+  CEventServerSession(const char *Host = "127.0.0.1", int Port = STD_PORT, const char *DeviceName = "cecanyway");
+  ~CEventServerSession();
+
+  bool Connect();
+  void Disconnect();
+  bool IsConnected();
+
+  // sends pre-encoded datagrams with a single sendmmsg()
+  bool Send(const encoded_datagram *Datagrams, unsigned int Count);
+
+  // title and message followed by the icon, if any, all fragments in one
+  // sendmmsg() straight from the mapped icon
+  bool SendNotification(const char *Title, const char *Message, const event_icon *Icon);
+
+  // maps an icon file for good, its type is taken from the extension
+  static bool LoadIcon(const char *Path, event_icon &Out);
+
+  static bool Encode(CPacket &Packet, encoded_datagram &Out);
+  static bool EncodeButton(const char *Button, const char *DeviceMap, encoded_button &Out);
+  // unqueued BTN_DOWN that xbmc repeats by itself until the BTN_UP arrives
+  static bool EncodeHold(const char *Button, const char *DeviceMap, encoded_button &Out);
+
+  // sends a PING if the session has been idle, reconnects if it was dropped
+  void Tick();
+
+  // the socket to watch for errors, and a number that changes on reconnect
+  int Fd(unsigned int &Generation);
+  // reads pending errors, drops the session if xbmc is not listening
+  void Drain();
+
+  unsigned int SendFailures() const { return m_SendFailures.load(std::memory_order_relaxed); }
+  unsigned int Reconnects() const { return m_Reconnects.load(std::memory_order_relaxed); }
+
+  static const int PING_INTERVAL = 30;      // seconds, xbmc drops clients after 60
+  static const int RECONNECT_INTERVAL = 2;  // seconds between connect attempts
+  static const unsigned int MAX_BATCH = 16;  // datagrams per sendmmsg()
+  static const unsigned int MAX_NOTIFICATION_PACKETS = 64;
+
+private:
+  bool ConnectLocked();
+  void DisconnectLocked(bool SayBye);
+  bool SendLocked(const encoded_datagram *Datagrams, unsigned int Count);
+  bool SendNotificationLocked(const char *Title, const char *Message, const event_icon *Icon);
+
+  std::string   m_Host;
+  int           m_Port;
+  std::string   m_DeviceName;
+  int           m_Socket;
+  CXBMCClient  *m_Client;
+  time_t        m_LastSend;
+  time_t        m_LastAttempt;
+  bool          m_WasConnected;
+  unsigned int  m_Generation;
+  std::atomic<bool>          m_Connected;
+  std::atomic<unsigned int>  m_SendFailures;
+  std::atomic<unsigned int>  m_Reconnects;
+  std::mutex    m_Lock;
+};
+
+#endif
@@ -0,0 +1,498 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "json.h"
+#include <ctype.h>
+#include <string.h>
+
+using namespace std;
+
+#define MAX_DEPTH 64
+
+namespace
+{
+
+class CJsonMinifier
+{
+public:
+  CJsonMinifier(const string &Json, string &Out)
+    : m_Pos(Json.c_str()), m_End(Json.c_str() + Json.length()), m_Out(Out), m_Depth(0) {}
+
+  bool Run()
+  {
+    m_Out.clear();
+    if (!Value())
+      return false;
+    SkipSpace();
+    return m_Pos == m_End;
+  }
+
+private:
+  void SkipSpace()
+  {
+    while (m_Pos < m_End && (*m_Pos == ' ' || *m_Pos == '\t' || *m_Pos == '\n' || *m_Pos == '\r'))
+      m_Pos++;
+  }
+
+  bool Digits()
+  {
+    const char *start = m_Pos;
+    while (m_Pos < m_End && *m_Pos >= '0' && *m_Pos <= '9')
+      m_Pos++;
+    return m_Pos > start;
+  }
+
+  bool Value()
+  {
+    SkipSpace();
+    if (m_Pos == m_End)
+      return false;
+
+    switch (*m_Pos)
+    {
+    case '{':
+      return Container('{', '}', true);
+    case '[':
+      return Container('[', ']', false);
+    case '"':
+      return String();
+    case 't':
+      return Literal("true");
+    case 'f':
+      return Literal("false");
+    case 'n':
+      return Literal("null");
+    default:
+      return Number();
+    }
+  }
+
+  bool Container(char open, char close, bool object)
+  {
+    if (++m_Depth > MAX_DEPTH)
+      return false;
+    m_Out += open;
+    m_Pos++;
+
+    SkipSpace();
+    if (m_Pos < m_End && *m_Pos == close)
+    {
+      m_Out += *m_Pos++;
+      m_Depth--;
+      return true;
+    }
+
+    for (;;)
+    {
+      if (object)
+      {
+        SkipSpace();
+        if (m_Pos == m_End || *m_Pos != '"' || !String())
+          return false;
+        SkipSpace();
+        if (m_Pos == m_End || *m_Pos != ':')
+          return false;
+        m_Out += *m_Pos++;
+      }
+      if (!Value())
+        return false;
+
+      SkipSpace();
+      if (m_Pos == m_End)
+        return false;
+      if (*m_Pos == close)
+      {
+        m_Out += *m_Pos++;
+        m_Depth--;
+        return true;
+      }
+      if (*m_Pos != ',')
+        return false;
+      m_Out += *m_Pos++;
+    }
+  }
+
+  bool String()
+  {
+    const char *start = m_Pos++;
+    while (m_Pos < m_End && *m_Pos != '"')
+    {
+      unsigned char c = *m_Pos++;
+      if (c < 0x20)
+        return false;
+      if (c != '\\')
+        continue;
+      if (m_Pos == m_End)
+        return false;
+
+      c = *m_Pos++;
+      if (c == 'u')
+      {
+        for (int i = 0; i < 4; i++, m_Pos++)
+          if (m_Pos == m_End || !isxdigit((unsigned char)*m_Pos))
+            return false;
+      }
+      else if (!strchr("\"\\/bfnrt", c))
+        return false;
+    }
+    if (m_Pos == m_End)
+      return false;
+
+    m_Pos++;
+    m_Out.append(start, m_Pos - start);
+    return true;
+  }
+
+  bool Number()
+  {
+    const char *start = m_Pos;
+    if (*m_Pos == '-')
+      m_Pos++;
+    if (m_Pos < m_End && *m_Pos == '0')
+      m_Pos++;
+    else if (!Digits())
+      return false;
+
+    if (m_Pos < m_End && *m_Pos == '.')
+    {
+      m_Pos++;
+      if (!Digits())
+        return false;
+    }
+    if (m_Pos < m_End && (*m_Pos == 'e' || *m_Pos == 'E'))
+    {
+      m_Pos++;
+      if (m_Pos < m_End && (*m_Pos == '+' || *m_Pos == '-'))
+        m_Pos++;
+      if (!Digits())
+        return false;
+    }
+
+    m_Out.append(start, m_Pos - start);
+    return true;
+  }
+
+  bool Literal(const char *literal)
+  {
+    size_t len = strlen(literal);
+    if ((size_t)(m_End - m_Pos) < len || strncmp(m_Pos, literal, len) != 0)
+      return false;
+    m_Out.append(literal, len);
+    m_Pos += len;
+    return true;
+  }
+
+  const char *m_Pos;
+  const char *m_End;
+  string     &m_Out;
+  int         m_Depth;
+};
+
+}
+
+bool jsonMinify(const string &Json, string &Out)
+{
+  return CJsonMinifier(Json, Out).Run();
+}
+
+static const char *skipSpace(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    p++;
+  return p;
+}
+
+// past the value starting at p, which must not be whitespace
+static const char *skipValue(const char *p, const char *end)
+{
+  if (p == end)
+    return end;
+
+  if (*p == '"')
+  {
+    for (p++; p < end && *p != '"'; p++)
+      if (*p == '\\')
+        p++;
+    return p < end ? p + 1 : end;
+  }
+
+  if (*p == '{' || *p == '[')
+  {
+    int depth = 0;
+    for (; p < end; p++)
+    {
+      if (*p == '"')
+      {
+        p = skipValue(p, end) - 1;
+        continue;
+      }
+      if (*p == '{' || *p == '[')
+        depth++;
+      else if ((*p == '}' || *p == ']') && --depth == 0)
+        return p + 1;
+    }
+    return end;
+  }
+
+  // number or literal
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+    p++;
+  return p;
+}
+
+bool jsonMember(json_span Json, const char *Name, json_span &Value)
+{
+  const char *p = skipSpace(Json.begin, Json.end);
+  if (p == Json.end || *p != '{')
+    return false;
+  size_t nameLength = strlen(Name);
+
+  for (p++; ; p++)
+  {
+    p = skipSpace(p, Json.end);
+    if (p == Json.end || *p != '"')
+      return false;
+    const char *key = p + 1;
+    p = skipValue(p, Json.end);
+    bool match = (size_t)(p - 1 - key) == nameLength && memcmp(key, Name, nameLength) == 0;
+
+    p = skipSpace(p, Json.end);
+    if (p == Json.end || *p != ':')
+      return false;
+    p = skipSpace(p + 1, Json.end);
+    const char *value = p;
+    p = skipValue(p, Json.end);
+    if (match)
+    {
+      Value.begin = value;
+      Value.end = p;
+      return p > value;
+    }
+
+    p = skipSpace(p, Json.end);
+    if (p == Json.end || *p != ',')
+      return false;
+  }
+}
+
+bool jsonInteger(json_span Value, long long &Out)
+{
+  const char *p = Value.begin;
+  bool negative = p < Value.end && *p == '-';
+  if (negative)
+    p++;
+  if (p == Value.end)
+    return false;
+
+  long long n = 0;
+  for (; p < Value.end; p++)
+  {
+    if (*p < '0' || *p > '9' || n > 99999999999999999LL)
+      return false;
+    n = n * 10 + (*p - '0');
+  }
+  Out = negative ? -n : n;
+  return true;
+}
+
+bool jsonString(json_span Value, json_span &Out)
+{
+  if (Value.end - Value.begin < 2 || *Value.begin != '"' || Value.end[-1] != '"')
+    return false;
+  Out.begin = Value.begin + 1;
+  Out.end = Value.end - 1;
+  return true;
+}
+
+bool jsonNextElement(json_span Json, json_span &Cursor)
+{
+  const char *p;
+  if (!Cursor.begin)
+  {
+    p = skipSpace(Json.begin, Json.end);
+    if (p == Json.end || *p != '[')
+      return false;
+    p++;
+  }
+  else
+  {
+    p = skipSpace(Cursor.end, Json.end);
+    if (p == Json.end || *p != ',')
+      return false;
+    p++;
+  }
+
+  p = skipSpace(p, Json.end);
+  if (p == Json.end || *p == ']')
+    return false;
+  Cursor.begin = p;
+  Cursor.end = skipValue(p, Json.end);
+  return true;
+}
+
+void CJsonFramer::Reset()
+{
+  m_Length = 0;
+  m_Consumed = 0;
+  m_Scanned = 0;
+  m_Start = 0;
+  m_Depth = 0;
+  m_InString = false;
+  m_Escape = false;
+  m_Discard = false;
+}
+
+char *CJsonFramer::Space(size_t &Length)
+{
+  if (m_Consumed > 0)
+  {
+    memmove(m_Buffer, m_Buffer + m_Consumed, m_Length - m_Consumed);
+    m_Length -= m_Consumed;
+    m_Scanned -= m_Consumed;
+    m_Start -= m_Start >= m_Consumed ? m_Consumed : m_Start;
+    m_Consumed = 0;
+  }
+  Length = BUFFER_SIZE - m_Length;
+  return m_Buffer + m_Length;
+}
+
+bool CJsonFramer::Next(json_span &Value)
+{
+  while (m_Scanned < m_Length)
+  {
+    char c = m_Buffer[m_Scanned++];
+    if (m_InString)
+    {
+      if (m_Escape)
+        m_Escape = false;
+      else if (c == '\\')
+        m_Escape = true;
+      else if (c == '"')
+        m_InString = false;
+      continue;
+    }
+
+    if (c == '"')
+      m_InString = true;
+    else if (c == '{' || c == '[')
+    {
+      if (m_Depth++ == 0)
+        m_Start = m_Scanned - 1;
+    }
+    else if ((c == '}' || c == ']') && m_Depth > 0 && --m_Depth == 0)
+    {
+      m_Consumed = m_Scanned;
+      if (m_Discard)
+      {
+        m_Discard = false;
+        continue;
+      }
+      Value.begin = m_Buffer + m_Start;
+      Value.end = m_Buffer + m_Scanned;
+      return true;
+    }
+    else if (m_Depth == 0)
+      m_Consumed = m_Scanned;   // whitespace between values
+  }
+
+  // a full buffer without a complete value: skip the rest of this one
+  if (m_Length == BUFFER_SIZE && m_Consumed == 0 && !m_Discard)
+  {
+    m_Discard = true;
+    m_Oversized++;
+  }
+  if (m_Discard)
+    m_Consumed = m_Scanned;
+  return false;
+}
+
+CJsonWriter &CJsonWriter::Raw(const char *Text, size_t Length)
+{
+  if (Length > m_Size - m_Length)
+  {
+    Length = m_Size - m_Length;
+    m_Overflowed = true;
+  }
+  memcpy(m_Buffer + m_Length, Text, Length);
+  m_Length += Length;
+  return *this;
+}
+
+CJsonWriter &CJsonWriter::String(const char *Text, size_t Length)
+{
+  static const char hex[] = "0123456789abcdef";
+  Raw("\"");
+
+  // copy runs that need no escaping in one go
+  const char *run = Text;
+  const char *end = Text + Length;
+  for (const char *p = Text; p < end; p++)
+  {
+    unsigned char c = *p;
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    Raw(run, p - run);
+    run = p + 1;
+
+    char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+    switch (c)
+    {
+    case '"':  Raw("\\\""); break;
+    case '\\': Raw("\\\\"); break;
+    case '\b': Raw("\\b"); break;
+    case '\f': Raw("\\f"); break;
+    case '\n': Raw("\\n"); break;
+    case '\r': Raw("\\r"); break;
+    case '\t': Raw("\\t"); break;
+    default:   Raw(escape, sizeof(escape)); break;
+    }
+  }
+  Raw(run, end - run);
+  return Raw("\"");
+}
+
+CJsonWriter &CJsonWriter::Integer(long long Value)
+{
+  char digits[24];
+  char *p = digits + sizeof(digits);
+  unsigned long long n = Value < 0 ? 0ULL - (unsigned long long)Value : Value;
+  do
+  {
+    *--p = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  if (Value < 0)
+    *--p = '-';
+  return Raw(p, digits + sizeof(digits) - p);
+}
+
+bool jsonShowNotification(CJsonWriter &Out, const char *Title, const char *Message, const char *Image, int DisplayTime)
+{
+  Out.Clear();
+  Out.Raw("{\"jsonrpc\":\"2.0\",\"method\":\"GUI.ShowNotification\",\"params\":{\"title\":").String(Title)
+     .Raw(",\"message\":").String(Message);
+  if (*Image)
+    Out.Raw(",\"image\":").String(Image);
+  if (DisplayTime > 0)
+    Out.Raw(",\"displaytime\":").Integer(DisplayTime);
+  Out.Raw("}}");
+  return !Out.Overflowed();
+}
@@ -0,0 +1,145 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+/*
+ * Checks that Json holds exactly one well-formed JSON value and copies it
+ * to Out without the whitespace between tokens. Returns false if it does
+ * not parse, Out is undefined then.
+ */
+bool jsonMinify(const std::string &Json, std::string &Out);
+
+// a stretch of JSON text, e.g. one value inside a larger document
+struct json_span
+{
+  const char *begin;
+  const char *end;
+};
+
+/*
+ * Allocation-free lookups for reading what xbmc sends. The text is assumed
+ * to be well-formed: values are skipped over by their brackets and quotes,
+ * not validated. Spans point into the text they were taken from.
+ */
+
+// the value of the member Name of the object in Json
+bool jsonMember(json_span Json, const char *Name, json_span &Value);
+bool jsonInteger(json_span Value, long long &Out);
+// the contents of a string value, escapes are left as they are
+bool jsonString(json_span Value, json_span &Out);
+// steps through the elements of the array in Json: Cursor starts out as
+// { NULL, NULL } and is moved to the next element by every call
+bool jsonNextElement(json_span Json, json_span &Cursor);
+
+/*
+ * Cuts a byte stream into top-level JSON values. xbmc writes its responses
+ * and notifications back to back on the socket, without delimiters.
+ *
+ * Data is received straight into Space() and handed to Commit(), then
+ * Next() returns each complete value. A value that does not fit into the
+ * fixed buffer is skipped and counted. Not thread-safe.
+ */
+class CJsonFramer
+{
+public:
+  CJsonFramer() : m_Oversized(0) { Reset(); }
+
+  // drops buffered data, e.g. after a reconnect
+  void Reset();
+
+  // where to put new data and how much fits; invalidates earlier values
+  char *Space(size_t &Length);
+  void Commit(size_t Length) { m_Length += Length; }
+
+  // the next complete value, valid until Space() is called
+  bool Next(json_span &Value);
+
+  unsigned int Oversized() const { return m_Oversized; }
+
+  static const size_t BUFFER_SIZE = 65536;
+
+private:
+  char          m_Buffer[BUFFER_SIZE];
+  size_t        m_Length;     // bytes in the buffer
+  size_t        m_Consumed;   // bytes returned or skipped, freed by Space()
+  size_t        m_Scanned;    // bytes looked at
+  size_t        m_Start;      // where the current value begins
+  int           m_Depth;
+  bool          m_InString;
+  bool          m_Escape;
+  bool          m_Discard;    // skipping the rest of an oversized value
+  unsigned int  m_Oversized;
+};
+
+/*
+ * Builds JSON text in a fixed buffer supplied by the caller, escaping
+ * strings on the way in, so nothing is allocated. Text that does not fit
+ * is cut off and Overflowed() set; the result must not be sent then.
+ */
+class CJsonWriter
+{
+public:
+  CJsonWriter(char *Buffer, size_t Size) : m_Buffer(Buffer), m_Size(Size) { Clear(); }
+
+  void Clear()
+  {
+    m_Length = 0;
+    m_Overflowed = false;
+  }
+
+  // appended as they are; literals are measured at compile time
+  CJsonWriter &Raw(const char *Text, size_t Length);
+  template <size_t N>
+  CJsonWriter &Raw(const char (&Literal)[N]) { return Raw(Literal, N - 1); }
+
+  // quoted and escaped
+  CJsonWriter &String(const char *Text, size_t Length);
+  CJsonWriter &String(const char *Text) { return String(Text, strlen(Text)); }
+  CJsonWriter &String(const std::string &Text) { return String(Text.data(), Text.length()); }
+  CJsonWriter &Integer(long long Value);
+
+  const char *Data() const { return m_Buffer; }
+  size_t Length() const { return m_Length; }
+  bool Overflowed() const { return m_Overflowed; }
+
+private:
+  char   *m_Buffer;
+  size_t  m_Size;
+  size_t  m_Length;
+  bool    m_Overflowed;
+};
+
+/*
+ * Precompiled json-rpc requests: the constant parts are literals copied
+ * as they are, only the arguments are escaped. They carry no id, the
+ * client assigns one. Out is cleared first; false if it overflowed.
+ */
+
+// GUI.ShowNotification, Image and DisplayTime (ms) are left out when empty or 0
+bool jsonShowNotification(CJsonWriter &Out, const char *Title, const char *Message, const char *Image, int DisplayTime);
+
+#endif
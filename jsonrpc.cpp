@@ -0,0 +1,547 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "jsonrpc.h"
+#include "monotonic.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+
+static bool spanIs(json_span Span, const char *Text)
+{
+  size_t length = strlen(Text);
+  return (size_t)(Span.end - Span.begin) == length && memcmp(Span.begin, Text, length) == 0;
+}
+
+CJsonRpcClient::CJsonRpcClient(const char *Host, int Port)
+  : m_Host(Host), m_Port(Port), m_Connected(false), m_SendFailures(0), m_Reconnects(0),
+    m_RoundTrip(), m_Errors(), m_Unanswered(0), m_Oversized(0), m_ActivePlayer(-1)
+{
+  m_Socket = -1;
+  m_NextAttempt = 0;
+  m_Backoff = BACKOFF_MIN_MS;
+  m_WasConnected = false;
+  m_Generation = 0;
+  m_NextId = 1;
+  memset(m_Pending, 0, sizeof(m_Pending));
+}
+
+CJsonRpcClient::~CJsonRpcClient()
+{
+  Disconnect();
+}
+
+bool CJsonRpcClient::Connect()
+{
+  lock_guard<mutex> lock(m_Lock);
+  return ConnectLocked();
+}
+
+void CJsonRpcClient::Disconnect()
+{
+  lock_guard<mutex> lock(m_Lock);
+  DisconnectLocked();
+}
+
+bool CJsonRpcClient::IsConnected()
+{
+  return m_Connected.load(memory_order_relaxed);
+}
+
+bool CJsonRpcClient::ConnectLocked()
+{
+  if (m_Socket >= 0)
+    return true;
+
+  int64_t now = monotonicMs();
+  if (now < m_NextAttempt)
+    return false;
+
+  struct sockaddr_in serv_addr;
+  memset(&serv_addr, 0, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_port = htons(m_Port);
+  if (inet_pton(AF_INET, m_Host.c_str(), &serv_addr.sin_addr) != 1)
+  {
+    cout << "error connecting to " << m_Host << ":" << m_Port << ", not an IPv4 address" << endl;
+    m_NextAttempt = now + BACKOFF_MAX_MS;
+    return false;
+  }
+
+  int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sockfd < 0)
+  {
+    cout << "error opening socket" << endl;
+    return false;
+  }
+
+  int ok = connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(struct sockaddr_in));
+  if (ok < 0 && errno == EINPROGRESS)
+  {
+    struct pollfd pfd = { sockfd, POLLOUT, 0 };
+    int error = ETIMEDOUT;
+    socklen_t len = sizeof(error);
+    if (poll(&pfd, 1, CONNECT_TIMEOUT_MS) == 1)
+      getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len);
+    ok = error ? -1 : 0;
+  }
+
+  if (ok < 0)
+  {
+    cout << "error connecting to " << m_Host << ":" << m_Port << ", retrying in " << m_Backoff << "ms" << endl;
+    close(sockfd);
+    m_NextAttempt = now + m_Backoff;
+    m_Backoff = min(m_Backoff * 2, (int)BACKOFF_MAX_MS);
+    return false;
+  }
+
+  int one = 1;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  m_Socket = sockfd;
+  m_Backoff = BACKOFF_MIN_MS;
+  m_Generation++;
+  if (m_WasConnected)
+    m_Reconnects.fetch_add(1, memory_order_relaxed);
+  m_WasConnected = true;
+  m_Connected = true;
+
+  // notifications keep the player up to date, this covers what played before
+  static const string activePlayers = "{\"jsonrpc\":\"2.0\",\"method\":\"Player.GetActivePlayers\"}";
+  if (!WriteRequestLocked(activePlayers))
+  {
+    cout << "error writing to " << m_Host << ":" << m_Port << ", reconnecting" << endl;
+    DisconnectLocked();
+    return false;
+  }
+  return true;
+}
+
+void CJsonRpcClient::DisconnectLocked()
+{
+  if (m_Socket < 0)
+    return;
+  close(m_Socket);
+  m_Socket = -1;
+  m_Connected = false;
+
+  // responses still in flight are lost with the connection
+  m_Framer.Reset();
+  ForgetPendingLocked(INT64_MAX);
+  m_ActivePlayer = -1;
+}
+
+bool CJsonRpcClient::DrainLocked()
+{
+  for (;;)
+  {
+    size_t space;
+    char *buf = m_Framer.Space(space);
+    ssize_t n = recv(m_Socket, buf, space, 0);
+    if (n > 0)
+    {
+      m_Framer.Commit(n);
+      json_span response;
+      while (m_Framer.Next(response))
+        HandleResponseLocked(response);
+      if (m_Framer.Oversized() != m_Oversized.load(memory_order_relaxed))
+      {
+        // its request, if any, ends up unanswered
+        cout << "json-rpc message larger than " << CJsonFramer::BUFFER_SIZE << " bytes dropped" << endl;
+        m_Oversized.store(m_Framer.Oversized(), memory_order_relaxed);
+      }
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return true;
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    // orderly shutdown or error, xbmc went away
+    DisconnectLocked();
+    return false;
+  }
+}
+
+void CJsonRpcClient::HandleResponseLocked(json_span Response)
+{
+  // a batch is answered with an array of responses
+  json_span element = { NULL, NULL };
+  if (!jsonNextElement(Response, element))
+  {
+    HandleReplyLocked(Response);
+    return;
+  }
+  do
+    HandleReplyLocked(element);
+  while (jsonNextElement(Response, element));
+}
+
+void CJsonRpcClient::HandleReplyLocked(json_span Response)
+{
+  json_span value;
+  long long id;
+  if (!jsonMember(Response, "id", value))
+  {
+    HandleNotificationLocked(Response);
+    return;
+  }
+  if (!jsonInteger(value, id) || id <= 0)
+    return;   // not one of ours
+
+  pending_call &call = m_Pending[id % MAX_PENDING];
+  if (call.id != (uint32_t)id)
+    return;   // answered after it had timed out
+  call.id = 0;
+  m_RoundTrip.Record(monotonicNs() - call.sent);
+
+  json_span result;
+  if (strcmp(call.method, "Player.GetActivePlayers") == 0 && jsonMember(Response, "result", result))
+  {
+    // the first player listed, an empty list if nothing plays
+    json_span first = { NULL, NULL };
+    long long player;
+    if (jsonNextElement(result, first) && jsonMember(first, "playerid", value) && jsonInteger(value, player))
+      m_ActivePlayer = (int)player;
+    else
+      m_ActivePlayer = -1;
+  }
+
+  json_span error;
+  if (!jsonMember(Response, "error", error))
+    return;
+
+  long long code = 0;
+  json_span message = { "", "" };
+  if (jsonMember(error, "code", value))
+    jsonInteger(value, code);
+  if (jsonMember(error, "message", value))
+    jsonString(value, message);
+  RecordErrorLocked((int)code);
+
+  cout << "json-rpc " << call.method << " on " << m_Host << ":" << m_Port << " failed: " << code << " ";
+  cout.write(message.begin, message.end - message.begin);
+  cout << endl;
+}
+
+void CJsonRpcClient::HandleNotificationLocked(json_span Notification)
+{
+  json_span value, method;
+  if (!jsonMember(Notification, "method", value) || !jsonString(value, method))
+    return;
+
+  if (spanIs(method, "Player.OnStop"))
+  {
+    m_ActivePlayer = -1;
+    return;
+  }
+  if (!spanIs(method, "Player.OnPlay") && !spanIs(method, "Player.OnResume") && !spanIs(method, "Player.OnAVStart"))
+    return;
+
+  // params.data.player.playerid
+  json_span params, data, player;
+  long long id;
+  if (jsonMember(Notification, "params", params) && jsonMember(params, "data", data)
+      && jsonMember(data, "player", player) && jsonMember(player, "playerid", value) && jsonInteger(value, id))
+    m_ActivePlayer = (int)id;
+}
+
+void CJsonRpcClient::RecordErrorLocked(int Code)
+{
+  // xbmc only uses a handful of codes, any beyond MAX_ERROR_CODES go uncounted
+  for (unsigned int i = 0; i < MAX_ERROR_CODES; i++)
+  {
+    unsigned int count = m_Errors[i].count.load(memory_order_relaxed);
+    if (count == 0)
+    {
+      m_Errors[i].code.store(Code, memory_order_relaxed);
+      m_Errors[i].count.store(1, memory_order_release);
+      return;
+    }
+    if (m_Errors[i].code.load(memory_order_relaxed) == Code)
+    {
+      m_Errors[i].count.fetch_add(1, memory_order_relaxed);
+      return;
+    }
+  }
+}
+
+unsigned int CJsonRpcClient::Errors(unsigned int Slot, int &Code) const
+{
+  unsigned int count = m_Errors[Slot].count.load(memory_order_acquire);
+  Code = m_Errors[Slot].code.load(memory_order_relaxed);
+  return count;
+}
+
+void CJsonRpcClient::ForgetPendingLocked(int64_t SentBefore)
+{
+  for (unsigned int i = 0; i < MAX_PENDING; i++)
+  {
+    if (m_Pending[i].id == 0 || m_Pending[i].sent >= SentBefore)
+      continue;
+    m_Pending[i].id = 0;
+    m_Unanswered.fetch_add(1, memory_order_relaxed);
+  }
+}
+
+bool CJsonRpcClient::WriteLocked(struct iovec *Parts, int Count)
+{
+  int64_t deadline = monotonicMs() + WRITE_TIMEOUT_MS;
+  while (Count > 0)
+  {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = Parts;
+    msg.msg_iovlen = Count;
+
+    ssize_t n = sendmsg(m_Socket, &msg, MSG_NOSIGNAL);
+    if (n >= 0)
+    {
+      // skip what has been written, including empty parts
+      while (Count > 0 && (size_t)n >= Parts->iov_len)
+      {
+        n -= Parts->iov_len;
+        Parts++;
+        Count--;
+      }
+      if (Count > 0)
+      {
+        Parts->iov_base = (char *)Parts->iov_base + n;
+        Parts->iov_len -= n;
+      }
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      int left = (int)(deadline - monotonicMs());
+      struct pollfd pfd = { m_Socket, POLLOUT, 0 };
+      if (left > 0 && poll(&pfd, 1, left) == 1)
+        continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+// a stretch of a request replaced on the way out, e.g. by the call's id
+struct json_patch
+{
+  const char *begin;
+  const char *end;
+  char        text[24];
+  int         length;
+};
+
+static bool patchId(json_span Call, uint32_t Id, json_patch &Patch)
+{
+  json_span value;
+  if (jsonMember(Call, "id", value))
+  {
+    Patch.begin = value.begin;
+    Patch.end = value.end;
+    Patch.length = snprintf(Patch.text, sizeof(Patch.text), "%u", Id);
+    return true;
+  }
+
+  // no id of its own: add one before the closing brace
+  const char *open = Call.begin;
+  while (open < Call.end && isspace((unsigned char)*open))
+    open++;
+  const char *close = Call.end;
+  while (close > open && close[-1] != '}')
+    close--;
+  if (open == Call.end || *open != '{' || close <= open + 1)
+    return false;
+  close--;
+
+  const char *first = open + 1;
+  while (first < close && isspace((unsigned char)*first))
+    first++;
+  Patch.begin = close;
+  Patch.end = close;
+  Patch.length = snprintf(Patch.text, sizeof(Patch.text), first == close ? "\"id\":%u" : ",\"id\":%u", Id);
+  return true;
+}
+
+// the playerid of a Player.* call, pointed at the active player
+static bool patchPlayer(json_span Call, int Player, json_patch &Patch)
+{
+  json_span value, method, params;
+  if (Player < 0 || !jsonMember(Call, "method", value) || !jsonString(value, method)
+      || method.end - method.begin < 7 || memcmp(method.begin, "Player.", 7) != 0
+      || !jsonMember(Call, "params", params) || !jsonMember(params, "playerid", value))
+    return false;
+
+  Patch.begin = value.begin;
+  Patch.end = value.end;
+  Patch.length = snprintf(Patch.text, sizeof(Patch.text), "%d", Player);
+  return true;
+}
+
+bool CJsonRpcClient::WriteRequestLocked(const string &Json)
+{
+  json_span request = { Json.data(), Json.data() + Json.length() };
+  const char *begin = request.begin;
+  const char *end = request.end;
+
+  // a batch array gets an id for each of its calls
+  json_span calls[MAX_BATCH_CALLS];
+  unsigned int count = 0;
+  json_span element = { NULL, NULL };
+  while (jsonNextElement(request, element))
+  {
+    if (count == MAX_BATCH_CALLS)
+    {
+      count = 0;
+      break;
+    }
+    calls[count++] = element;
+  }
+  if (!element.begin)
+    calls[count++] = request;
+
+  // every call gets its id, Player.* calls also the active player
+  uint32_t ids[MAX_BATCH_CALLS];
+  json_patch patches[2 * MAX_BATCH_CALLS];
+  struct iovec parts[4 * MAX_BATCH_CALLS + 1];
+  int player = m_ActivePlayer.load(memory_order_relaxed);
+  int n = 0;
+  const char *from = begin;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    ids[i] = m_NextId++;
+    if (m_NextId == 0)
+      m_NextId = 1;
+    json_patch *patch = &patches[2 * i];
+    if (!patchId(calls[i], ids[i], patch[0]))
+    {
+      // not something we can answer for, sent as it is
+      count = 0;
+      n = 0;
+      from = begin;
+      break;
+    }
+
+    int used = 1;
+    if (patchPlayer(calls[i], player, patch[1]))
+    {
+      used = 2;
+      if (patch[1].begin < patch[0].begin)
+        swap(patch[0], patch[1]);
+    }
+    for (int j = 0; j < used; j++)
+    {
+      parts[n].iov_base = (void *)from;
+      parts[n++].iov_len = patch[j].begin - from;
+      parts[n].iov_base = patch[j].text;
+      parts[n++].iov_len = patch[j].length;
+      from = patch[j].end;
+    }
+  }
+  parts[n].iov_base = (void *)from;
+  parts[n++].iov_len = end - from;
+
+  int64_t now = monotonicNs();
+  for (unsigned int i = 0; i < count; i++)
+  {
+    pending_call &call = m_Pending[ids[i] % MAX_PENDING];
+    if (call.id != 0)
+      m_Unanswered.fetch_add(1, memory_order_relaxed);
+    call.id = ids[i];
+    call.sent = now;
+    call.method[0] = '\0';
+    json_span value, method;
+    if (jsonMember(calls[i], "method", value) && jsonString(value, method))
+    {
+      size_t length = min((size_t)(method.end - method.begin), sizeof(call.method) - 1);
+      memcpy(call.method, method.begin, length);
+      call.method[length] = '\0';
+    }
+  }
+
+  if (WriteLocked(parts, n))
+    return true;
+  for (unsigned int i = 0; i < count; i++)
+    m_Pending[ids[i] % MAX_PENDING].id = 0;
+  return false;
+}
+
+bool CJsonRpcClient::Send(const string &Json)
+{
+  lock_guard<mutex> lock(m_Lock);
+
+  // one retry: the kept-alive connection may have been closed by xbmc
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    if (m_Socket >= 0)
+      DrainLocked();
+    if (!ConnectLocked())
+    {
+      m_SendFailures.fetch_add(1, memory_order_relaxed);
+      return false;
+    }
+
+    if (WriteRequestLocked(Json))
+      return true;
+
+    cout << "error writing to " << m_Host << ":" << m_Port << ", reconnecting" << endl;
+    m_SendFailures.fetch_add(1, memory_order_relaxed);
+    DisconnectLocked();
+  }
+  return false;
+}
+
+int CJsonRpcClient::Fd(unsigned int &Generation)
+{
+  lock_guard<mutex> lock(m_Lock);
+  Generation = m_Generation;
+  return m_Socket;
+}
+
+void CJsonRpcClient::Drain()
+{
+  lock_guard<mutex> lock(m_Lock);
+  if (m_Socket >= 0)
+    DrainLocked();
+}
+
+void CJsonRpcClient::Tick()
+{
+  lock_guard<mutex> lock(m_Lock);
+  if (m_Socket >= 0)
+    DrainLocked();
+  ForgetPendingLocked(monotonicNs() - (int64_t)RESPONSE_TIMEOUT_MS * 1000000);
+  if (m_Socket < 0)
+    ConnectLocked();
+}
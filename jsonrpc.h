@@ -0,0 +1,142 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __JSONRPC_H__
+#define __JSONRPC_H__
+
+#include "json.h"
+#include "latency.h"
+#include <stdint.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+/*
+ * A persistent connection to the xbmc json-rpc tcp server.
+ *
+ * Requests are written back to back on one keep-alive socket, each call
+ * with an id of its own that replaces whatever id the caller put in, also
+ * inside batch arrays of up to MAX_BATCH_CALLS calls. Responses are read
+ * whenever the client is used or its socket becomes readable, matched to
+ * their request by id, and their round trip time and error code recorded.
+ * Reading also tells us when xbmc has closed the connection. Connecting is
+ * non-blocking with a deadline, and failed attempts back off exponentially
+ * so a busy or dead xbmc never holds up the caller for longer than
+ * CONNECT_TIMEOUT_MS.
+ *
+ * xbmc sends its notifications to every connected client. The active
+ * player is asked for once per connection and then followed through
+ * Player.OnPlay and Player.OnStop, and the params.playerid of every
+ * Player.* call is rewritten to it on the way out, so keys mapped with a
+ * fixed playerid control audio and picture players as well.
+ */
+class CJsonRpcClient
+{
+public:
+  CJsonRpcClient(const char *Host = "127.0.0.1", int Port = 9090);
+  ~CJsonRpcClient();
+
+  bool Connect();
+  void Disconnect();
+  bool IsConnected();
+
+  bool Send(const std::string &Json);
+
+  // drains pending responses and reconnects once the backoff has expired
+  void Tick();
+
+  // the socket to watch for responses, and a number that changes on reconnect
+  int Fd(unsigned int &Generation);
+  void Drain();
+
+  unsigned int SendFailures() const { return m_SendFailures.load(std::memory_order_relaxed); }
+  unsigned int Reconnects() const { return m_Reconnects.load(std::memory_order_relaxed); }
+
+  // time from writing a request until its response was read
+  const CLatencyHistogram &RoundTrip() const { return m_RoundTrip; }
+  // requests that timed out or whose connection was lost before the response
+  unsigned int Unanswered() const { return m_Unanswered.load(std::memory_order_relaxed); }
+  // responses and notifications too large for the framer, dropped unread
+  unsigned int Oversized() const { return m_Oversized.load(std::memory_order_relaxed); }
+  // error responses by code, for Slot in [0, MAX_ERROR_CODES); 0 for unused slots
+  unsigned int Errors(unsigned int Slot, int &Code) const;
+
+  // the playerid Player.* calls are sent with, -1 if nothing plays or it is not known
+  int ActivePlayer() const { return m_ActivePlayer.load(std::memory_order_relaxed); }
+
+  static const int CONNECT_TIMEOUT_MS = 500;
+  static const int WRITE_TIMEOUT_MS = 500;
+  static const int BACKOFF_MIN_MS = 250;
+  static const int BACKOFF_MAX_MS = 8000;
+  static const int RESPONSE_TIMEOUT_MS = 5000;
+  static const unsigned int MAX_PENDING = 64;      // power of two
+  static const unsigned int MAX_ERROR_CODES = 8;
+  static const unsigned int MAX_BATCH_CALLS = 16;  // calls given ids of their own
+
+private:
+  // a request waiting for its response
+  struct pending_call
+  {
+    uint32_t id;              // 0 for a free slot
+    int64_t  sent;            // monotonicNs()
+    char     method[48];
+  };
+
+  struct error_count
+  {
+    std::atomic<int>           code;
+    std::atomic<unsigned int>  count;
+  };
+
+  bool ConnectLocked();
+  void DisconnectLocked();
+  bool DrainLocked();
+  bool WriteLocked(struct iovec *Parts, int Count);
+  bool WriteRequestLocked(const std::string &Json);
+  void HandleResponseLocked(json_span Response);
+  void HandleReplyLocked(json_span Response);
+  void HandleNotificationLocked(json_span Notification);
+  void RecordErrorLocked(int Code);
+  void ForgetPendingLocked(int64_t SentBefore);
+
+  std::string  m_Host;
+  int          m_Port;
+  int          m_Socket;
+  int64_t      m_NextAttempt;
+  int          m_Backoff;
+  bool         m_WasConnected;
+  unsigned int m_Generation;
+  std::atomic<bool>          m_Connected;
+  std::atomic<unsigned int>  m_SendFailures;
+  std::atomic<unsigned int>  m_Reconnects;
+  uint32_t     m_NextId;
+  pending_call m_Pending[MAX_PENDING];   // indexed by id % MAX_PENDING
+  CJsonFramer  m_Framer;
+  CLatencyHistogram          m_RoundTrip;
+  error_count                m_Errors[MAX_ERROR_CODES];
+  std::atomic<unsigned int>  m_Unanswered;
+  std::atomic<unsigned int>  m_Oversized;   // the framer's count, for other threads
+  std::atomic<int>           m_ActivePlayer;
+  std::mutex   m_Lock;
+};
+
+#endif
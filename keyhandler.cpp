@@ -0,0 +1,750 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "keyhandler.h"
+#include "monotonic.h"
+#include "metrics.h"
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <exception>
+
+using namespace CEC;
+using namespace std;
+
+bool                  logEvents;
+key_repeat            navigationRepeat = REPEAT_HOLD;
+unsigned int          volumeWindow = DEFAULT_VOLUME_WINDOW;
+unsigned int          osdInterval = DEFAULT_OSD_INTERVAL;
+osd_transport         osdTransport = OSD_JSONRPC;
+event_icon            osdIcon = { ICON_NONE, NULL, 0 };
+vector<CKeyContext *> keyContexts;
+pulseaudio            pulse;
+CLatencyStats         latency;
+CActionRunner         runner;
+atomic<unsigned int>  keyPresses[256];
+atomic<unsigned int>  actions[ACT_TYPES];
+
+void populateKeyMapDefault(map<int, string> &keyMap)
+{
+  /* NOT USED */
+  keyMap[CEC_USER_CONTROL_CODE_LEFT] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Left\"}";
+  keyMap[CEC_USER_CONTROL_CODE_RIGHT] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Right\"}";
+  keyMap[CEC_USER_CONTROL_CODE_DOWN] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Down\"}";
+  keyMap[CEC_USER_CONTROL_CODE_UP] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Up\"}";
+  keyMap[CEC_USER_CONTROL_CODE_SELECT] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Select\"}";
+  keyMap[CEC_USER_CONTROL_CODE_EXIT] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Back\"}";
+  keyMap[CEC_USER_CONTROL_CODE_PLAY] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.PlayPause\", \"params\": { \"playerid\": 1 }, \"id\": 1}";
+  keyMap[CEC_USER_CONTROL_CODE_STOP] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Stop\", \"params\": { \"playerid\": 1 }, \"id\": 1}";
+  keyMap[CEC_USER_CONTROL_CODE_PAUSE] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.PlayPause\", \"params\": { \"playerid\": 1 }, \"id\": 1}";
+  keyMap[CEC_USER_CONTROL_CODE_REWIND] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Seek\", \"params\": { \"playerid\": 1, \"value\": \"smallbackward\" }, \"id\": 1}";
+  keyMap[CEC_USER_CONTROL_CODE_BACKWARD] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Seek\", \"params\": { \"playerid\": 1, \"value\": \"bigbackward\" }, \"id\": 1}";
+  keyMap[CEC_USER_CONTROL_CODE_FAST_FORWARD] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Seek\", \"params\": { \"playerid\": 1, \"value\": \"smallforward\" }, \"id\": 1}";
+  keyMap[CEC_USER_CONTROL_CODE_FORWARD] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Seek\", \"params\": { \"playerid\": 1, \"value\": \"bigforward\" }, \"id\": 1}";
+
+  /* USED */
+  keyMap[CEC_USER_CONTROL_CODE_CLEAR] = "{\"jsonrpc\": \"2.0\", \"method\": \"Input.Home\", \"id\": 1}";
+  keyMap[CEC_USER_CONTROL_CODE_ELECTRONIC_PROGRAM_GUIDE] = "{\"jsonrpc\": \"2.0\", \"method\": \"GUI.SetFullscreen\", \"params\": { \"name\": \"fullscreen\", \"value\": \"toggle\" }, \"id\": 1}";
+  keyMap[CEC_USER_CONTROL_CODE_F1_BLUE] = "exec returntodesktop.sh";
+}
+
+void populateEventMapDefault(map<int, string> &eventMap)
+{
+  eventMap[CEC_USER_CONTROL_CODE_LEFT] = "left";
+  eventMap[CEC_USER_CONTROL_CODE_RIGHT] = "right";
+  eventMap[CEC_USER_CONTROL_CODE_DOWN] = "down";
+  eventMap[CEC_USER_CONTROL_CODE_UP] = "up";
+  eventMap[CEC_USER_CONTROL_CODE_SELECT] = "select";
+  eventMap[CEC_USER_CONTROL_CODE_EXIT] = "back";
+  eventMap[CEC_USER_CONTROL_CODE_PLAY] = "play";
+  eventMap[CEC_USER_CONTROL_CODE_STOP] = "stop";
+  eventMap[CEC_USER_CONTROL_CODE_PAUSE] = "pause";
+  eventMap[CEC_USER_CONTROL_CODE_REWIND] = "reverse";
+  eventMap[CEC_USER_CONTROL_CODE_BACKWARD] = "skipminus";
+  eventMap[CEC_USER_CONTROL_CODE_FAST_FORWARD] = "forward";
+  eventMap[CEC_USER_CONTROL_CODE_FORWARD] = "skipplus";
+  // eventMap[CEC_USER_CONTROL_CODE_F1_BLUE] = "blue";
+  eventMap[CEC_USER_CONTROL_CODE_F2_RED] = "red";
+  eventMap[CEC_USER_CONTROL_CODE_F3_GREEN] = "green";
+  eventMap[CEC_USER_CONTROL_CODE_F4_YELLOW] = "yellow";
+  eventMap[CEC_USER_CONTROL_CODE_SETUP_MENU] = "title";
+  eventMap[CEC_USER_CONTROL_CODE_ELECTRONIC_PROGRAM_GUIDE] = "backslash";
+
+  eventMap[CEC_USER_CONTROL_CODE_CHANNEL_UP] = "pageplus";
+  eventMap[CEC_USER_CONTROL_CODE_CHANNEL_DOWN] = "pageminus";
+}
+
+bool populateKeyMapFromFile(istream &file, map<int, string> &keyMap)
+{
+  bool error = false;
+  int i = 1;
+  while (file.good())
+  {
+    unsigned int keycode;
+    string assignLiteral = "=>";
+    string appendLiteral = "+>";
+    string literal;
+    string json;
+
+    if (!(file >> keycode))
+    {
+      if (!file.eof()) error = true;
+      break;
+    }
+    if (!(file >> literal))
+    {
+      error = true;
+      break;
+    }
+    if (literal != assignLiteral && literal != appendLiteral)
+    {
+      error = true;
+      break;
+    }
+    getline(file, json);
+    // "+>" adds another action, the key runs them all in order
+    if (literal == appendLiteral && keyMap.count(keycode))
+      keyMap[keycode] += "\n" + json;
+    else
+      keyMap[keycode] = json;
+    i++;
+  }
+
+  if (error)
+    cout << "could not parse config file line #" << i << endl;
+  return !error;
+}
+
+// one action of a config line: a json-rpc body, "exec <command> [args]"
+// to run a command or "button <name>" to press an event server button
+static bool parseAction(const string &text, key_action &action)
+{
+  size_t start = text.find_first_not_of(" \t");
+  if (start != string::npos && text.compare(start, 5, "exec ") == 0)
+  {
+    action.type = ACT_EXEC;
+    action.payload = text.substr(start + 5);
+    return true;
+  }
+
+  if (start != string::npos && text.compare(start, 7, "button ") == 0)
+  {
+    string name = text.substr(start + 7);
+    name.erase(name.find_last_not_of(" \t\r") + 1);
+    if (!CEventServerSession::EncodeButton(name.c_str(), "R1", action.button)
+        || !CEventServerSession::EncodeHold(name.c_str(), "R1", action.hold))
+    {
+      cout << "button name too long: " << name << endl;
+      return false;
+    }
+    action.type = ACT_EVENTSERVER;
+    action.payload.clear();
+    return true;
+  }
+
+  action.type = ACT_JSONRPC;
+  action.payload = text;
+  return true;
+}
+
+// the json-rpc requests of a step become a batch once there are two
+static void closeBatch(macro_step &step, unsigned int calls)
+{
+  if (step.type == ACT_JSONRPC && calls > 1)
+    step.payload = "[" + step.payload + "]";
+}
+
+// the actions of a key, one per line, merged into as few sends as possible
+static void buildMacro(const string &text, key_action &action)
+{
+  action.type = ACT_MACRO;
+  action.label.clear();
+  action.macro.clear();
+
+  unsigned int calls = 0;   // in the last step's batch
+  size_t from = 0;
+  while (from <= text.length())
+  {
+    size_t to = text.find('\n', from);
+    if (to == string::npos)
+      to = text.length();
+    string line = text.substr(from, to - from);
+    from = to + 1;
+
+    key_action parsed;
+    if (!parseAction(line, parsed))
+      continue;
+    action.label += (action.label.empty() ? "" : " ; ") + line;
+
+    macro_step *last = action.macro.empty() ? NULL : &action.macro.back();
+    if (last && last->type == ACT_JSONRPC && parsed.type == ACT_JSONRPC && calls < CJsonRpcClient::MAX_BATCH_CALLS)
+    {
+      last->payload += "," + parsed.payload;
+      calls++;
+      continue;
+    }
+    if (last && last->type == ACT_EVENTSERVER && parsed.type == ACT_EVENTSERVER
+        && last->datagrams.size() + 2 <= CXbmcTarget::MAX_DATAGRAMS)
+    {
+      last->datagrams.push_back(parsed.button.packets[0]);
+      last->datagrams.push_back(parsed.button.packets[1]);
+      continue;
+    }
+
+    if (last)
+      closeBatch(*last, calls);
+    macro_step step;
+    step.type = parsed.type;
+    step.payload = parsed.payload;
+    if (parsed.type == ACT_EVENTSERVER)
+    {
+      step.datagrams.push_back(parsed.button.packets[0]);
+      step.datagrams.push_back(parsed.button.packets[1]);
+    }
+    action.macro.push_back(step);
+    calls = parsed.type == ACT_JSONRPC ? 1 : 0;
+  }
+  if (!action.macro.empty())
+    closeBatch(action.macro.back(), calls);
+}
+
+CKeyTable *buildKeyTable(const map<int, string> &keyMap, const map<int, string> &eventMap)
+{
+  CKeyTable *table = new CKeyTable;
+  CKeyTable &keyTable = *table;
+
+  // same precedence as before the table existed: specials, then eventMap, then
+  // keyMap with the config file merged in, so the config cannot remap buttons
+  for (map<int, string>::const_iterator it = keyMap.begin(); it != keyMap.end(); ++it)
+  {
+    key_action &action = keyTable[it->first];
+    if (it->second.find('\n') != string::npos)
+      buildMacro(it->second, action);
+    else if (parseAction(it->second, action))
+      action.label = it->second;
+  }
+
+  for (map<int, string>::const_iterator it = eventMap.begin(); it != eventMap.end(); ++it)
+  {
+    const char *deviceMap = "R1";
+    if (it->first == CEC_USER_CONTROL_CODE_ELECTRONIC_PROGRAM_GUIDE)
+      deviceMap = "KB";
+
+    key_action &action = keyTable[it->first];
+    if (!CEventServerSession::EncodeButton(it->second.c_str(), deviceMap, action.button)
+        || !CEventServerSession::EncodeHold(it->second.c_str(), deviceMap, action.hold))
+    {
+      cout << "button name too long: " << it->second << endl;
+      continue;
+    }
+    action.type = ACT_EVENTSERVER;
+    action.payload.clear();
+    action.label = it->second;
+  }
+
+  keyTable[CEC_USER_CONTROL_CODE_VOLUME_UP].type = ACT_VOLUME;
+  keyTable[CEC_USER_CONTROL_CODE_VOLUME_UP].steps = 1;
+  keyTable[CEC_USER_CONTROL_CODE_VOLUME_UP].label = "volume up";
+  keyTable[CEC_USER_CONTROL_CODE_VOLUME_DOWN].type = ACT_VOLUME;
+  keyTable[CEC_USER_CONTROL_CODE_VOLUME_DOWN].steps = -1;
+  keyTable[CEC_USER_CONTROL_CODE_VOLUME_DOWN].label = "volume down";
+  keyTable[CEC_USER_CONTROL_CODE_MUTE].type = ACT_MUTE;
+  keyTable[CEC_USER_CONTROL_CODE_MUTE].label = "mute";
+
+  // STOP also reacts to the event sent when the key is released
+  keyTable[CEC_USER_CONTROL_CODE_STOP].withDuration = true;
+
+  // navigation keys repeat while held, xbmc does it if it can
+  static const int navigationKeys[] = {
+    CEC_USER_CONTROL_CODE_UP, CEC_USER_CONTROL_CODE_DOWN, CEC_USER_CONTROL_CODE_LEFT, CEC_USER_CONTROL_CODE_RIGHT,
+    CEC_USER_CONTROL_CODE_CHANNEL_UP, CEC_USER_CONTROL_CODE_CHANNEL_DOWN
+  };
+  for (unsigned int i = 0; i < sizeof(navigationKeys) / sizeof(navigationKeys[0]); i++)
+  {
+    key_action &action = keyTable[navigationKeys[i]];
+    if (action.type != ACT_EVENTSERVER && action.type != ACT_JSONRPC)
+      continue;
+    action.repeat = navigationRepeat;
+    if (action.repeat == REPEAT_HOLD && action.type != ACT_EVENTSERVER)
+      action.repeat = REPEAT_TIMER;
+  }
+  return table;
+}
+
+CKeyTable *loadKeyTable(const string &path)
+{
+  map<int, string> defaultMap;
+  map<int, string> eventMap;
+  populateKeyMapDefault(defaultMap);
+  populateEventMapDefault(eventMap);
+
+  map<int, string> keyMap(defaultMap);
+  ifstream configFileStream(path.c_str());
+  if (configFileStream && !populateKeyMapFromFile(configFileStream, keyMap))
+    return NULL;
+
+  CKeyTable *table = buildKeyTable(keyMap, eventMap);
+
+  // buttons and specials win over the config, say so instead of ignoring it quietly
+  for (map<int, string>::const_iterator it = keyMap.begin(); it != keyMap.end(); ++it)
+  {
+    map<int, string>::const_iterator def = defaultMap.find(it->first);
+    if (def != defaultMap.end() && def->second == it->second)
+      continue;
+
+    const key_action &action = (*table)[it->first];
+    if (eventMap.count(it->first) || action.type == ACT_VOLUME || action.type == ACT_MUTE)
+      cout << "config line for keycode " << it->first << " is ignored, the key is fixed to " << action.label << endl;
+  }
+  return table;
+}
+
+void publishKeyTable(CKeyContext &context, CKeyTable *table)
+{
+  // a table that was published but never picked up was never read either
+  delete context.pendingTable.exchange(table);
+  context.dispatcher.Wake();
+}
+
+void reloadKeyTable(const string &path)
+{
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+  {
+    CKeyContext &context = *keyContexts[i];
+    if (context.configPath != path)
+      continue;
+
+    CKeyTable *table = loadKeyTable(path);
+    if (!table)
+    {
+      cout << "keeping the current key map" << endl;
+      return;
+    }
+    publishKeyTable(context, table);
+    cout << "reloaded " << path << " for " << context.name << endl;
+  }
+}
+
+void applyVolumeSteps(void *context, int steps)
+{
+  try {
+    int64_t start = monotonicNs();
+    float vol = pulse.modify_volume(steps * VOLUME_STEP);
+    latency.RecordTransport(ACT_VOLUME, monotonicNs() - start);
+    char title[32];
+    snprintf(title, sizeof(title), "Volume %d%%", int(vol*100));
+    ((CKeyContext *)context)->osd.Post(title, steps > 0 ? "Volume increased" : "Volume decreased", "VolumeIcon.png");
+  } catch (exception &e) {
+    cerr<<"Error while changing volume by "<<steps<<" steps - "<<e.what()<<endl;
+  }
+}
+
+// queues the datagrams for every target, none waits for another
+static void sendDatagrams(CKeyContext &context, const encoded_datagram *datagrams, unsigned int count)
+{
+  for (unsigned int i = 0; i < context.targets.size(); i++)
+    if (!context.targets[i]->Send(datagrams, count))
+      cerr << "send queue full, dropped event for " << context.targets[i]->Name() << endl;
+}
+
+static void sendJson(CKeyContext &context, const char *json, size_t length)
+{
+  for (unsigned int i = 0; i < context.targets.size(); i++)
+    if (!context.targets[i]->Send(json, length))
+      cerr << "send queue full, dropped request for " << context.targets[i]->Name() << endl;
+}
+
+static void runAction(CKeyContext &context, const key_action &action, bool hold)
+{
+  switch (action.type)
+  {
+  case ACT_EVENTSERVER:
+    if (hold)
+      sendDatagrams(context, &action.hold.packets[0], 1);
+    else
+      sendDatagrams(context, action.button.packets, 2);
+    break;
+  case ACT_JSONRPC:
+    sendJson(context, action.payload.data(), action.payload.length());
+    break;
+  case ACT_VOLUME:
+    context.volumeSteps.Add(action.steps);
+    break;
+  case ACT_MUTE:
+  {
+    bool mute = pulse.togglemute();
+    char message[32];
+    snprintf(message, sizeof(message), "Volume %d%%", int(pulse.volume()*100));
+    context.osd.Post(mute?"Volume Muted":"Volume Unmuted", message, "VolumeIcon.png");
+    break;
+  }
+  case ACT_EXEC:
+    if (!runner.Run(action.payload))
+      cerr << "cannot queue " << action.payload << endl;
+    break;
+  case ACT_MACRO:
+    for (unsigned int i = 0; i < action.macro.size(); i++)
+    {
+      const macro_step &step = action.macro[i];
+      if (step.type == ACT_EVENTSERVER)
+        sendDatagrams(context, step.datagrams.data(), step.datagrams.size());
+      else if (step.type == ACT_JSONRPC)
+        sendJson(context, step.payload.data(), step.payload.length());
+      else if (step.type == ACT_EXEC && !runner.Run(step.payload))
+        cerr << "cannot queue " << step.payload << endl;
+    }
+    break;
+  case ACT_NONE:
+  default:
+    break;
+  }
+}
+
+static void repeatKey(void *ctx, int keycode)
+{
+  CKeyContext &context = *(CKeyContext *)ctx;
+  const key_action &action = (*context.keyTable)[keycode];
+  int64_t start = monotonicNs();
+  actions[action.type].fetch_add(1, memory_order_relaxed);
+  runAction(context, action, false);
+  latency.RecordTransport(action.type, monotonicNs() - start);
+}
+
+static void releaseKey(void *ctx, int keycode)
+{
+  CKeyContext &context = *(CKeyContext *)ctx;
+  const key_action &action = (*context.keyTable)[keycode];
+  if (action.repeat == REPEAT_HOLD)
+    sendDatagrams(context, &action.hold.packets[1], 1);
+}
+
+static void showNotification(void *ctx, const notification &n)
+{
+  CKeyContext &context = *(CKeyContext *)ctx;
+  if (osdTransport == OSD_JSONRPC)
+  {
+    showxbmcalert(context, n.title, n.message, n.image, n.displaytime);
+    return;
+  }
+
+  const event_icon *icon = osdIcon.type != ICON_NONE ? &osdIcon : NULL;
+  for (unsigned int i = 0; i < context.targets.size(); i++)
+    if (!context.targets[i]->Send(n, icon))
+      cerr << "send queue full, dropped notification for " << context.targets[i]->Name() << endl;
+}
+
+CKeyContext::CKeyContext(const string &Name, const string &ConfigPath, const vector<xbmc_endpoint> &Targets)
+  : name(Name), configPath(ConfigPath), keyTable(new CKeyTable), pendingTable(NULL),
+    volumeSteps(&applyVolumeSteps, this, volumeWindow),
+    osd(&showNotification, this, osdInterval),
+    keyRepeater(&repeatKey, &releaseKey, this)
+{
+  for (unsigned int i = 0; i < Targets.size(); i++)
+    targets.push_back(new CXbmcTarget(Targets[i]));
+}
+
+CKeyContext::~CKeyContext()
+{
+  Stop();
+  for (unsigned int i = 0; i < targets.size(); i++)
+    delete targets[i];
+  delete pendingTable.exchange(NULL);
+  delete keyTable;
+}
+
+bool CKeyContext::Start()
+{
+  for (unsigned int i = 0; i < targets.size(); i++)
+    if (!targets[i]->Start())
+      return false;
+  return dispatcher.Start(&handleKeyPress, &tickKeyHandler, this);
+}
+
+void CKeyContext::Stop()
+{
+  dispatcher.Stop();
+  for (unsigned int i = 0; i < targets.size(); i++)
+    targets[i]->Stop();
+}
+
+// swaps in a newly published key table, on the dispatcher thread, which is
+// the only one reading the table, so the old one can go right away
+static void adoptKeyTable(CKeyContext &context)
+{
+  if (!context.pendingTable.load(memory_order_relaxed))
+    return;
+
+  CKeyTable *table = context.pendingTable.exchange(NULL);
+  if (!table)
+    return;
+
+  // a held key is let go under the mapping it was pressed with
+  if (context.keyRepeater.Held() >= 0)
+    releaseKey(&context, context.keyRepeater.Release());
+  delete context.keyTable;
+  context.keyTable = table;
+}
+
+// the earlier of two timeouts, -1 meaning none
+static int earliest(int a, int b)
+{
+  if (a < 0 || (b >= 0 && b < a))
+    return b;
+  return a;
+}
+
+int tickKeyHandler(void *ctx)
+{
+  CKeyContext &context = *(CKeyContext *)ctx;
+  adoptKeyTable(context);
+  int volume = context.volumeSteps.Flush();
+  // after the volume, which may have posted a notification
+  int osd = context.osd.Flush();
+  int repeat = context.keyRepeater.Tick();
+  return earliest(earliest(volume, osd), repeat);
+}
+
+void handleKeyPress(void *ctx, const queued_keypress &event)
+{
+  CKeyContext &context = *(CKeyContext *)ctx;
+  CKeyRepeater &keyRepeater = context.keyRepeater;
+  const cec_keypress &key = event.key;
+  try {
+  std::cout<<"Key press "<<key.keycode<<" " << key.duration<<std::endl;
+  adoptKeyTable(context);
+  const key_action &action = (*context.keyTable)[key.keycode];
+
+  // a release or the press of another key ends the current hold, libcec
+  // pressing the held key again changes nothing
+  if (keyRepeater.Held() >= 0)
+  {
+    if (key.duration == 0 && keyRepeater.Held() == key.keycode)
+      return;
+    releaseKey(&context, keyRepeater.Release());
+  }
+
+  if (key.duration == 0 || action.withDuration)
+  {
+    int64_t start = monotonicNs();
+    latency.RecordKey(LATENCY_QUEUE, key.keycode, start - event.queued);
+    keyPresses[key.keycode & 0xff].fetch_add(1, memory_order_relaxed);
+    actions[action.type].fetch_add(1, memory_order_relaxed);
+
+    bool hold = action.repeat == REPEAT_HOLD && key.duration == 0;
+    runAction(context, action, hold);
+    if (action.repeat != REPEAT_NONE && key.duration == 0)
+      keyRepeater.Press(key.keycode, action.repeat == REPEAT_TIMER);
+
+    int64_t done = monotonicNs();
+    // volume changes are coalesced, their pulse round trip is timed when applied
+    if (action.type != ACT_NONE && action.type != ACT_VOLUME)
+      latency.RecordTransport(action.type, done - start);
+    latency.RecordKey(LATENCY_HANDLE, key.keycode, done - event.queued);
+
+    if (logEvents)
+      cout << context.name << ": keycode: " << key.keycode << ", xbmc command: " << (action.type == ACT_NONE ? "unmapped" : action.label)
+           << ", handled after " << (done - event.queued) / 1000 << "us" << endl;
+  }
+  } catch (exception e) {
+     cerr<<"Error while handling keycode:"<<key.keycode<<" - "<<e.what()<<endl;
+  }
+}
+
+int CecKeyPressCB(void *context, const cec_keypress key)
+{
+  // runs on the adapter's libcec thread, the actual work is done by its dispatcher
+  if (!((CKeyContext *)context)->dispatcher.Push(key))
+    cerr << "dispatch queue full, dropped keycode:" << key.keycode << endl;
+  return 0;
+}
+
+void showxbmcalert(CKeyContext &context, const char *title, const char *message, const char *image, int displaytime)
+{
+  char buffer[1024];
+  CJsonWriter json(buffer, sizeof(buffer));
+  if (!jsonShowNotification(json, title, message, image, displaytime))
+  {
+    cerr << "notification too long: " << title << endl;
+    return;
+  }
+
+  if (logEvents)
+  {
+    cout.write(json.Data(), json.Length());
+    cout << endl;
+  }
+  sendJson(context, json.Data(), json.Length());
+}
+
+static string targetLabels(const CKeyContext &context, const CXbmcTarget &target)
+{
+  return "adapter=\"" + context.name + "\",target=\"" + target.Name() + "\"";
+}
+
+void writeMetrics(ostream &out)
+{
+  metricHeader(out, "cecanyway_key_presses_total", "counter", "Key presses handled, by cec keycode.");
+  for (unsigned int keycode = 0; keycode < 256; keycode++)
+  {
+    unsigned int count = keyPresses[keycode].load(memory_order_relaxed);
+    if (count)
+      out << "cecanyway_key_presses_total{keycode=\"" << keycode << "\"} " << count << "\n";
+  }
+
+  metricHeader(out, "cecanyway_key_presses_dropped_total", "counter", "Key presses dropped because the dispatch queue was full, by adapter.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    out << "cecanyway_key_presses_dropped_total{adapter=\"" << keyContexts[i]->name << "\"} "
+        << keyContexts[i]->dispatcher.Dropped() << "\n";
+
+  metricHeader(out, "cecanyway_dispatch_queue_depth", "gauge", "Key presses waiting in the dispatch queue, by adapter.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    out << "cecanyway_dispatch_queue_depth{adapter=\"" << keyContexts[i]->name << "\"} "
+        << keyContexts[i]->dispatcher.Depth() << "\n";
+
+  metricHeader(out, "cecanyway_notifications_superseded_total", "counter", "OSD notifications replaced by a newer one before they were shown, by adapter.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    out << "cecanyway_notifications_superseded_total{adapter=\"" << keyContexts[i]->name << "\"} "
+        << keyContexts[i]->osd.Superseded() << "\n";
+
+  metricHeader(out, "cecanyway_actions_total", "counter", "Key actions performed, by transport.");
+  for (unsigned int type = ACT_NONE + 1; type < ACT_TYPES; type++)
+    out << "cecanyway_actions_total{transport=\"" << key_action_name((key_action_type)type) << "\"} "
+        << actions[type].load(memory_order_relaxed) << "\n";
+
+  metricHeader(out, "cecanyway_send_failures_total", "counter", "Failed sends to xbmc, by adapter, target and transport.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+    {
+      CXbmcTarget &target = *keyContexts[i]->targets[j];
+      string labels = targetLabels(*keyContexts[i], target);
+      out << "cecanyway_send_failures_total{" << labels << ",transport=\"eventserver\"} "
+          << target.EventServer().SendFailures() << "\n";
+      out << "cecanyway_send_failures_total{" << labels << ",transport=\"jsonrpc\"} "
+          << target.RpcClient().SendFailures() << "\n";
+    }
+
+  metricHeader(out, "cecanyway_send_dropped_total", "counter", "Requests dropped because a target's send queue was full, by adapter and target.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+      out << "cecanyway_send_dropped_total{" << targetLabels(*keyContexts[i], *keyContexts[i]->targets[j]) << "} "
+          << keyContexts[i]->targets[j]->Dropped() << "\n";
+
+  metricHeader(out, "cecanyway_reconnects_total", "counter", "Reconnects to xbmc after a lost connection, by adapter, target and transport.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+    {
+      CXbmcTarget &target = *keyContexts[i]->targets[j];
+      string labels = targetLabels(*keyContexts[i], target);
+      out << "cecanyway_reconnects_total{" << labels << ",transport=\"eventserver\"} "
+          << target.EventServer().Reconnects() << "\n";
+      out << "cecanyway_reconnects_total{" << labels << ",transport=\"jsonrpc\"} "
+          << target.RpcClient().Reconnects() << "\n";
+    }
+
+  metricHeader(out, "cecanyway_exec_failures_total", "counter", "Exec actions that could not be run or exited with an error.");
+  out << "cecanyway_exec_failures_total " << runner.Failures() << "\n";
+  metricHeader(out, "cecanyway_exec_timeouts_total", "counter", "Exec actions that were killed for running too long.");
+  out << "cecanyway_exec_timeouts_total " << runner.Timeouts() << "\n";
+
+  metricHeader(out, "cecanyway_eventserver_connected", "gauge", "Whether the event server session is registered, by adapter and target.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+      out << "cecanyway_eventserver_connected{" << targetLabels(*keyContexts[i], *keyContexts[i]->targets[j]) << "} "
+          << keyContexts[i]->targets[j]->EventServer().IsConnected() << "\n";
+  metricHeader(out, "cecanyway_jsonrpc_connected", "gauge", "Whether the json-rpc connection is up, by adapter and target.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+      out << "cecanyway_jsonrpc_connected{" << targetLabels(*keyContexts[i], *keyContexts[i]->targets[j]) << "} "
+          << keyContexts[i]->targets[j]->RpcClient().IsConnected() << "\n";
+
+  metricHeader(out, "cecanyway_active_player", "gauge", "The xbmc player Player.* requests are sent to, -1 if none is playing, by adapter and target.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+      out << "cecanyway_active_player{" << targetLabels(*keyContexts[i], *keyContexts[i]->targets[j]) << "} "
+          << keyContexts[i]->targets[j]->RpcClient().ActivePlayer() << "\n";
+
+  metricHeader(out, "cecanyway_send_duration_seconds", "summary", "Time from queueing a request for a target until it was sent, by adapter, target and transport.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+    {
+      const CXbmcTarget &target = *keyContexts[i]->targets[j];
+      string labels = targetLabels(*keyContexts[i], target);
+      metricSummary(out, "cecanyway_send_duration_seconds", labels + ",transport=\"eventserver\"", target.Latency(ACT_EVENTSERVER));
+      metricSummary(out, "cecanyway_send_duration_seconds", labels + ",transport=\"jsonrpc\"", target.Latency(ACT_JSONRPC));
+    }
+
+  metricHeader(out, "cecanyway_jsonrpc_round_trip_seconds", "summary", "Time from writing a json-rpc request until xbmc answered it, by adapter and target.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+    {
+      const CXbmcTarget &target = *keyContexts[i]->targets[j];
+      metricSummary(out, "cecanyway_jsonrpc_round_trip_seconds", targetLabels(*keyContexts[i], target), target.RpcClient().RoundTrip());
+    }
+
+  metricHeader(out, "cecanyway_jsonrpc_errors_total", "counter", "Error responses from xbmc, by adapter, target and json-rpc error code.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+    {
+      const CXbmcTarget &target = *keyContexts[i]->targets[j];
+      string labels = targetLabels(*keyContexts[i], target);
+      for (unsigned int slot = 0; slot < CJsonRpcClient::MAX_ERROR_CODES; slot++)
+      {
+        int code;
+        unsigned int count = target.RpcClient().Errors(slot, code);
+        if (count)
+          out << "cecanyway_jsonrpc_errors_total{" << labels << ",code=\"" << code << "\"} " << count << "\n";
+      }
+    }
+
+  metricHeader(out, "cecanyway_jsonrpc_unanswered_total", "counter", "Json-rpc requests that timed out or lost their connection before xbmc answered, by adapter and target.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+      out << "cecanyway_jsonrpc_unanswered_total{" << targetLabels(*keyContexts[i], *keyContexts[i]->targets[j]) << "} "
+          << keyContexts[i]->targets[j]->RpcClient().Unanswered() << "\n";
+
+  metricHeader(out, "cecanyway_jsonrpc_oversized_total", "counter", "Json-rpc messages from xbmc too large to read, dropped, by adapter and target.");
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+      out << "cecanyway_jsonrpc_oversized_total{" << targetLabels(*keyContexts[i], *keyContexts[i]->targets[j]) << "} "
+          << keyContexts[i]->targets[j]->RpcClient().Oversized() << "\n";
+
+  metricHeader(out, "cecanyway_action_duration_seconds", "summary", "Time spent performing a key action, by transport.");
+  for (unsigned int type = ACT_NONE + 1; type < ACT_TYPES; type++)
+  {
+    string labels = string("transport=\"") + key_action_name((key_action_type)type) + "\"";
+    metricSummary(out, "cecanyway_action_duration_seconds", labels, latency.Transport((key_action_type)type));
+  }
+}
+
+void dumpLatency(ostream &out)
+{
+  latency.Dump(out);
+  for (unsigned int i = 0; i < keyContexts.size(); i++)
+    for (unsigned int j = 0; j < keyContexts[i]->targets.size(); j++)
+    {
+      const CXbmcTarget &target = *keyContexts[i]->targets[j];
+      string what = "send " + keyContexts[i]->name + " " + target.Name() + " ";
+      dumpHistogram(out, (what + "eventserver").c_str(), target.Latency(ACT_EVENTSERVER));
+      dumpHistogram(out, (what + "jsonrpc").c_str(), target.Latency(ACT_JSONRPC));
+      dumpHistogram(out, ("round trip " + keyContexts[i]->name + " " + target.Name()).c_str(), target.RpcClient().RoundTrip());
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __KEYHANDLER_H__
+#define __KEYHANDLER_H__
+
+#include "libcec/cec.h"
+#include "eventserver.h"
+#include "jsonrpc.h"
+#include "dispatch.h"
+#include "pulseaudio.h"
+#include "coalescer.h"
+#include "keytable.h"
+#include "latency.h"
+#include "notifier.h"
+#include "repeater.h"
+#include "runner.h"
+#include "target.h"
+#include <atomic>
+#include <map>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define HOST "127.0.0.1"
+#define DEFAULT_PORT 9090
+#define DEFAULT_VOLUME_WINDOW 100
+#define DEFAULT_OSD_INTERVAL 250
+#define VOLUME_STEP 0.10
+
+enum osd_transport
+{
+  OSD_JSONRPC = 0,     // GUI.ShowNotification with xbmc's own volume icon
+  OSD_EVENTSERVER      // notification packets carrying osdIcon
+};
+
+/*
+ * The key handling path: libcec's key press callback, the handler the
+ * dispatcher runs for every key, and the transports it talks to. Kept apart
+ * from main() so the benchmark can drive exactly the code the daemon runs.
+ */
+
+/*
+ * Everything the key presses of one CEC adapter go through: its key map,
+ * the dispatcher thread that handles them and the xbmc instances they
+ * control, every action is sent to all of them. It is libcec's callback
+ * parameter for that adapter. Pulse, the action runner and the counters
+ * are shared by all adapters.
+ */
+class CKeyContext : public CAlignedAlloc
+{
+public:
+  CKeyContext(const std::string &Name, const std::string &ConfigPath, const std::vector<xbmc_endpoint> &Targets);
+  ~CKeyContext();
+
+  // starts the targets and the dispatcher thread
+  bool Start();
+  void Stop();
+
+  std::string               name;         // the adapter's port, for logs and metrics
+  std::string               configPath;
+  CKeyTable                *keyTable;     // only for the dispatcher thread
+  std::atomic<CKeyTable *>  pendingTable;
+  std::vector<CXbmcTarget *> targets;
+  CKeyDispatcher            dispatcher;
+  CCoalescer                volumeSteps;
+  CNotifier                 osd;
+  CKeyRepeater              keyRepeater;
+};
+
+extern bool                      logEvents;
+extern key_repeat                navigationRepeat;
+extern unsigned int              volumeWindow;
+extern unsigned int              osdInterval;
+extern osd_transport             osdTransport;
+extern event_icon                osdIcon;        // type ICON_NONE without an icon file
+extern std::vector<CKeyContext *> keyContexts;   // for metrics and reloads
+extern pulseaudio                pulse;
+extern CLatencyStats             latency;
+extern CActionRunner             runner;
+extern std::atomic<unsigned int> keyPresses[256];
+extern std::atomic<unsigned int> actions[ACT_TYPES];
+
+void populateKeyMapDefault(std::map<int, std::string> &keyMap);
+void populateEventMapDefault(std::map<int, std::string> &eventMap);
+bool populateKeyMapFromFile(std::istream &file, std::map<int, std::string> &keyMap);
+CKeyTable *buildKeyTable(const std::map<int, std::string> &keyMap, const std::map<int, std::string> &eventMap);
+
+// defaults plus the config file if there is one, NULL if it does not parse
+CKeyTable *loadKeyTable(const std::string &path);
+
+// hands a new table to the context's dispatcher thread, which swaps it in
+// before the next key press; may be called from any thread
+void publishKeyTable(CKeyContext &context, CKeyTable *table);
+// reloads every context using the config file at path
+void reloadKeyTable(const std::string &path);
+
+// shows a notification in xbmc right away, see CNotifier for rate limited ones
+void showxbmcalert(CKeyContext &context, const char *title, const char *message, const char *image = "", int displaytime = 0);
+void applyVolumeSteps(void *context, int steps);
+
+// dispatcher ticker: flushes volume steps and repeats held keys
+int tickKeyHandler(void *context);
+
+void handleKeyPress(void *context, const queued_keypress &event);
+int CecKeyPressCB(void *context, const CEC::cec_keypress key);
+
+void writeMetrics(std::ostream &out);
+// the latency stats plus how long each target took to send
+void dumpLatency(std::ostream &out);
+
+#endif
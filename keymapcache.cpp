@@ -0,0 +1,322 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "keymapcache.h"
+#include "json.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// bump whenever the record layout or the built-in key map changes
+#define KEYMAP_CACHE_VERSION 3
+// a sanity limit for the record count of a damaged cache
+#define MAX_MACRO_STEPS 64
+
+static const char KEYMAP_CACHE_MAGIC[8] = { 'C', 'E', 'C', 'K', 'M', 'A', 'P', 0 };
+
+struct keymap_cache_header
+{
+  char      magic[8];
+  uint32_t  version;
+  uint32_t  checksum;        // of everything after the header
+  uint64_t  configSize;      // 0 and 0 if there was no config file
+  int64_t   configMtimeSec;
+  int64_t   configMtimeNsec;
+  uint32_t  repeat;
+  uint32_t  entries;
+  uint32_t  stringsSize;
+  uint32_t  reserved;
+};
+
+// a mapped key, followed by one record per step if it is a macro
+struct keymap_cache_entry
+{
+  uint8_t         keycode;
+  uint8_t         type;
+  uint8_t         withDuration;
+  uint8_t         repeat;
+  uint32_t        step;            // 0 for the key, 1.. for its macro steps
+  int32_t         steps;
+  uint32_t        payloadOffset;
+  uint32_t        payloadLength;
+  uint32_t        labelOffset;
+  uint32_t        labelLength;
+  encoded_button  button;
+  encoded_button  hold;
+};
+
+static uint32_t fnv1a(const char *data, size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash ^= (unsigned char)data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void stampConfig(const string &configPath, keymap_cache_header &header)
+{
+  struct stat st;
+  header.configSize = 0;
+  header.configMtimeSec = 0;
+  header.configMtimeNsec = 0;
+  if (stat(configPath.c_str(), &st) == 0)
+  {
+    header.configSize = st.st_size;
+    header.configMtimeSec = st.st_mtim.tv_sec;
+    header.configMtimeNsec = st.st_mtim.tv_nsec;
+  }
+}
+
+static bool writeAll(int fd, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t n = write(fd, data, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+static bool minifyPayload(unsigned int keycode, string &payload)
+{
+  string json;
+  if (!jsonMinify(payload, json))
+  {
+    cout << "keycode " << keycode << ": invalid json: " << payload << endl;
+    return false;
+  }
+  payload = json;
+  return true;
+}
+
+bool compileKeyTable(CKeyTable &table, const string &configPath, const string &cachePath, key_repeat repeat)
+{
+  vector<keymap_cache_entry> entries;
+  string strings;
+
+  for (unsigned int keycode = 0; keycode < 256; keycode++)
+  {
+    key_action &action = table[keycode];
+    if (action.type == ACT_NONE && !action.withDuration)
+      continue;
+
+    if (action.type == ACT_JSONRPC && !minifyPayload(keycode, action.payload))
+      return false;
+
+    keymap_cache_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.keycode = keycode;
+    entry.type = action.type;
+    entry.withDuration = action.withDuration;
+    entry.repeat = action.repeat;
+    entry.steps = action.steps;
+    entry.payloadOffset = strings.length();
+    entry.payloadLength = action.payload.length();
+    strings += action.payload;
+    entry.labelOffset = strings.length();
+    entry.labelLength = action.label.length();
+    strings += action.label;
+    entry.button = action.button;
+    entry.hold = action.hold;
+    entries.push_back(entry);
+
+    // button steps keep their datagrams in the strings, in native layout
+    for (unsigned int i = 0; i < action.macro.size(); i++)
+    {
+      macro_step &step = action.macro[i];
+      if (step.type == ACT_JSONRPC && !minifyPayload(keycode, step.payload))
+        return false;
+      if (step.type == ACT_EVENTSERVER)
+        step.payload.assign((const char *)step.datagrams.data(), step.datagrams.size() * sizeof(encoded_datagram));
+
+      memset(&entry, 0, sizeof(entry));
+      entry.keycode = keycode;
+      entry.type = step.type;
+      entry.step = i + 1;
+      entry.payloadOffset = strings.length();
+      entry.payloadLength = step.payload.length();
+      strings += step.payload;
+      entry.labelOffset = strings.length();
+      entries.push_back(entry);
+      if (step.type == ACT_EVENTSERVER)
+        step.payload.clear();
+    }
+  }
+
+  keymap_cache_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, KEYMAP_CACHE_MAGIC, sizeof(header.magic));
+  header.version = KEYMAP_CACHE_VERSION;
+  stampConfig(configPath, header);
+  header.repeat = repeat;
+  header.entries = entries.size();
+  header.stringsSize = strings.length();
+
+  string body((const char *)entries.data(), entries.size() * sizeof(keymap_cache_entry));
+  body += strings;
+  header.checksum = fnv1a(body.data(), body.length());
+
+  // write a temporary file and rename it, a running daemon never sees half a cache
+  string tmpPath = cachePath + ".tmp";
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    cout << "cannot create " << tmpPath << ": " << strerror(errno) << endl;
+    return false;
+  }
+  bool ok = writeAll(fd, (const char *)&header, sizeof(header)) && writeAll(fd, body.data(), body.length())
+            && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmpPath.c_str(), cachePath.c_str()) < 0)
+  {
+    cout << "cannot write " << cachePath << ": " << strerror(errno) << endl;
+    unlink(tmpPath.c_str());
+    return false;
+  }
+
+  cout << "compiled " << entries.size() << " keys from " << configPath << " into " << cachePath << endl;
+  return true;
+}
+
+// the steps follow their key in order
+static bool addMacroStep(key_action &action, const keymap_cache_entry &entry, const char *strings)
+{
+  if (action.type != ACT_MACRO || entry.step != action.macro.size() + 1)
+    return false;
+
+  macro_step step;
+  step.type = (key_action_type)entry.type;
+  if (step.type == ACT_EVENTSERVER)
+  {
+    if (entry.payloadLength % sizeof(encoded_datagram) != 0)
+      return false;
+    // copied, the strings are not aligned
+    step.datagrams.resize(entry.payloadLength / sizeof(encoded_datagram));
+    memcpy(step.datagrams.data(), strings + entry.payloadOffset, entry.payloadLength);
+  }
+  else
+    step.payload.assign(strings + entry.payloadOffset, entry.payloadLength);
+  action.macro.push_back(step);
+  return true;
+}
+
+static CKeyTable *buildFromCache(const char *data, size_t length, const keymap_cache_header &expected)
+{
+  if (length < sizeof(keymap_cache_header))
+    return NULL;
+
+  keymap_cache_header header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, KEYMAP_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != KEYMAP_CACHE_VERSION)
+    return NULL;
+  if (header.configSize != expected.configSize || header.configMtimeSec != expected.configMtimeSec
+      || header.configMtimeNsec != expected.configMtimeNsec || header.repeat != expected.repeat)
+    return NULL;
+  if (header.entries > 256 * (MAX_MACRO_STEPS + 1)
+      || length != sizeof(header) + header.entries * sizeof(keymap_cache_entry) + header.stringsSize)
+    return NULL;
+
+  const char *body = data + sizeof(header);
+  if (fnv1a(body, length - sizeof(header)) != header.checksum)
+    return NULL;
+
+  const keymap_cache_entry *entries = (const keymap_cache_entry *)body;
+  const char *strings = body + header.entries * sizeof(keymap_cache_entry);
+
+  CKeyTable *table = new CKeyTable;
+  for (unsigned int i = 0; i < header.entries; i++)
+  {
+    const keymap_cache_entry &entry = entries[i];
+    if (entry.type >= ACT_TYPES
+        || (uint64_t)entry.payloadOffset + entry.payloadLength > header.stringsSize
+        || (uint64_t)entry.labelOffset + entry.labelLength > header.stringsSize)
+    {
+      delete table;
+      return NULL;
+    }
+
+    key_action &action = (*table)[entry.keycode];
+    if (entry.step > 0)
+    {
+      if (!addMacroStep(action, entry, strings))
+      {
+        delete table;
+        return NULL;
+      }
+      continue;
+    }
+    action.type = (key_action_type)entry.type;
+    action.withDuration = entry.withDuration;
+    action.repeat = (key_repeat)entry.repeat;
+    action.steps = entry.steps;
+    action.payload.assign(strings + entry.payloadOffset, entry.payloadLength);
+    action.label.assign(strings + entry.labelOffset, entry.labelLength);
+    action.button = entry.button;
+    action.hold = entry.hold;
+  }
+  return table;
+}
+
+CKeyTable *loadKeyTableCache(const string &configPath, const string &cachePath, key_repeat repeat)
+{
+  int fd = open(cachePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  keymap_cache_header expected;
+  stampConfig(configPath, expected);
+  expected.repeat = repeat;
+
+  CKeyTable *table = buildFromCache((const char *)data, st.st_size, expected);
+  munmap(data, st.st_size);
+  if (!table)
+    cout << cachePath << " is out of date, reading " << configPath << endl;
+  return table;
+}
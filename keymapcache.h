@@ -0,0 +1,46 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __KEYMAPCACHE_H__
+#define __KEYMAPCACHE_H__
+
+#include "keytable.h"
+#include <string>
+
+/*
+ * A compiled key table, so startup needs neither the config parser nor
+ * the packet encoder.
+ *
+ * The cache holds one fixed-size record per mapped key, with the event
+ * server packets already encoded, followed by the json-rpc bodies. It is
+ * stamped with the size and mtime of the config file it was compiled from
+ * and the repeat mode, and checksummed. The file is mmap'ed and used only if
+ * all of that still matches; it is meant for the machine and build that
+ * wrote it, so the records are stored in native layout.
+ */
+
+// validates and minifies the json-rpc bodies, then writes the cache
+bool compileKeyTable(CKeyTable &table, const std::string &configPath, const std::string &cachePath, key_repeat repeat);
+
+// NULL if the cache is missing, damaged or stale
+CKeyTable *loadKeyTableCache(const std::string &configPath, const std::string &cachePath, key_repeat repeat);
+
+#endif
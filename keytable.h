@@ -0,0 +1,99 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __KEYTABLE_H__
+#define __KEYTABLE_H__
+
+#include "eventserver.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum key_action_type
+{
+  ACT_NONE = 0,
+  ACT_EVENTSERVER,   // pre-encoded button datagrams
+  ACT_JSONRPC,       // json-rpc request body
+  ACT_VOLUME,        // relative volume steps
+  ACT_MUTE,          // toggle mute
+  ACT_EXEC,          // external command, run by the action runner
+  ACT_MACRO,         // several of the above in order
+  ACT_TYPES
+};
+
+inline const char *key_action_name(key_action_type type)
+{
+  static const char *names[ACT_TYPES] = { "none", "eventserver", "jsonrpc", "volume", "mute", "exec", "macro" };
+  return names[type];
+}
+
+enum key_repeat
+{
+  REPEAT_NONE = 0,
+  REPEAT_HOLD,       // BTN_DOWN on press, BTN_UP on release, xbmc repeats
+  REPEAT_TIMER       // the action is repeated by an accelerating timer
+};
+
+/*
+ * One step of a macro. Consecutive json-rpc requests are merged into one
+ * batch array and consecutive buttons into one run of datagrams when the
+ * table is built, so each step is a single send.
+ */
+struct macro_step
+{
+  key_action_type                type;        // ACT_EVENTSERVER, ACT_JSONRPC or ACT_EXEC
+  std::vector<encoded_datagram>  datagrams;   // ACT_EVENTSERVER
+  std::string                    payload;     // ACT_JSONRPC body or batch, ACT_EXEC command line
+
+  macro_step() : type(ACT_NONE) {}
+};
+
+// everything needed to handle a key, resolved when the table is built
+struct key_action
+{
+  key_action_type type;
+  bool            withDuration;   // also handle the event sent on release
+  key_repeat      repeat;         // what happens while the key is held
+  int             steps;          // ACT_VOLUME
+  encoded_button  button;         // ACT_EVENTSERVER
+  encoded_button  hold;           // ACT_EVENTSERVER with REPEAT_HOLD
+  std::string     payload;        // ACT_JSONRPC body, ACT_EXEC command line
+  std::string     label;          // for logging
+  std::vector<macro_step> macro;  // ACT_MACRO
+
+  key_action() : type(ACT_NONE), withDuration(false), repeat(REPEAT_NONE), steps(0), button(), hold() {}
+};
+
+/*
+ * CEC user control codes fit into a byte, so the actions are kept in a
+ * flat array indexed by keycode. Unmapped codes hold an ACT_NONE entry.
+ */
+class CKeyTable
+{
+public:
+  const key_action &operator[](unsigned int keycode) const { return m_Actions[keycode & 0xff]; }
+  key_action &operator[](unsigned int keycode) { return m_Actions[keycode & 0xff]; }
+
+private:
+  key_action m_Actions[256];
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "latency.h"
+
+using namespace std;
+
+uint64_t CLatencyHistogram::Count() const
+{
+  uint64_t count = 0;
+  for (unsigned int i = 0; i < BUCKETS; i++)
+    count += m_Buckets[i].load(memory_order_relaxed);
+  return count;
+}
+
+int64_t CLatencyHistogram::UpperBound(unsigned int bucket)
+{
+  if (bucket < 4)
+    return bucket;
+  unsigned int msb = bucket / 4 + 1;
+  int64_t width = (int64_t)1 << (msb - 2);
+  return (int64_t)(4 + bucket % 4) * width + width - 1;
+}
+
+int64_t CLatencyHistogram::Percentile(double p) const
+{
+  uint32_t counts[BUCKETS];
+  uint64_t total = 0;
+  for (unsigned int i = 0; i < BUCKETS; i++)
+  {
+    counts[i] = m_Buckets[i].load(memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0)
+    return 0;
+
+  uint64_t rank = (uint64_t)(p * total);
+  if (rank >= total)
+    rank = total - 1;
+
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < BUCKETS; i++)
+  {
+    seen += counts[i];
+    if (seen > rank)
+    {
+      int64_t bound = UpperBound(i);
+      return bound < Max() ? bound : Max();
+    }
+  }
+  return Max();
+}
+
+void dumpHistogram(ostream &out, const char *what, const CLatencyHistogram &h)
+{
+  uint64_t count = h.Count();
+  if (count == 0)
+    return;
+  out << "latency " << what << ": n=" << count
+      << " p50=" << h.Percentile(0.50) / 1000 << "us"
+      << " p90=" << h.Percentile(0.90) / 1000 << "us"
+      << " p99=" << h.Percentile(0.99) / 1000 << "us"
+      << " max=" << h.Max() / 1000 << "us" << endl;
+}
+
+void CLatencyStats::Dump(ostream &out) const
+{
+  static const char *stageNames[LATENCY_KEY_STAGES] = { "queue", "handle" };
+
+  for (unsigned int stage = 0; stage < LATENCY_KEY_STAGES; stage++)
+  {
+    for (unsigned int keycode = 0; keycode < 256; keycode++)
+    {
+      string what = string(stageNames[stage]) + " keycode " + to_string(keycode);
+      dumpHistogram(out, what.c_str(), m_Keys[stage][keycode]);
+    }
+  }
+
+  for (unsigned int type = ACT_NONE + 1; type < ACT_TYPES; type++)
+  {
+    string what = string("transport ") + key_action_name((key_action_type)type);
+    dumpHistogram(out, what.c_str(), m_Transports[type]);
+  }
+}
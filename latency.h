@@ -0,0 +1,114 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include "keytable.h"
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+
+/*
+ * Log-linear latency histogram in nanoseconds.
+ *
+ * Every power of two is split into 4 buckets, so a reported percentile is
+ * at most 25% above the true value. Recording is a few relaxed atomic
+ * operations and never blocks; readers may see a sample counted but not
+ * yet reflected in the maximum, which is fine for monitoring.
+ *
+ * There is no constructor: instances are meant to be static, so they start
+ * zeroed and untouched buckets never cost resident memory.
+ */
+class CLatencyHistogram
+{
+public:
+  void Record(int64_t ns)
+  {
+    if (ns < 0)
+      ns = 0;
+    m_Buckets[Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_Sum.fetch_add(ns, std::memory_order_relaxed);
+    int64_t max = m_Max.load(std::memory_order_relaxed);
+    while (ns > max && !m_Max.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+      ;
+  }
+
+  uint64_t Count() const;
+  int64_t Percentile(double p) const;   // upper bound of the bucket holding p
+  int64_t Max() const { return m_Max.load(std::memory_order_relaxed); }
+  int64_t Sum() const { return m_Sum.load(std::memory_order_relaxed); }
+
+  static const unsigned int BUCKETS = 140;  // up to 2^35ns, about 34s
+
+private:
+  static unsigned int Bucket(uint64_t ns)
+  {
+    if (ns < 4)
+      return ns;
+    unsigned int msb = 63 - __builtin_clzll(ns);
+    unsigned int bucket = (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+  }
+  static int64_t UpperBound(unsigned int bucket);
+
+  std::atomic<uint32_t> m_Buckets[BUCKETS];
+  std::atomic<int64_t>  m_Max;
+  std::atomic<int64_t>  m_Sum;
+};
+
+enum latency_stage
+{
+  LATENCY_QUEUE = 0,   // libcec callback until the dispatcher picks it up
+  LATENCY_HANDLE,      // libcec callback until the action has been carried out
+  LATENCY_KEY_STAGES
+};
+
+/*
+ * Per keycode stage latencies plus the time each transport takes to carry
+ * out an action (socket sends, pulse operations, queueing commands).
+ */
+class CLatencyStats
+{
+public:
+  void RecordKey(latency_stage stage, unsigned int keycode, int64_t ns)
+  {
+    m_Keys[stage][keycode & 0xff].Record(ns);
+  }
+
+  void RecordTransport(key_action_type type, int64_t ns)
+  {
+    m_Transports[type].Record(ns);
+  }
+
+  const CLatencyHistogram &Transport(key_action_type type) const { return m_Transports[type]; }
+
+  void Dump(std::ostream &out) const;
+
+private:
+  CLatencyHistogram m_Keys[LATENCY_KEY_STAGES][256];
+  CLatencyHistogram m_Transports[ACT_TYPES];
+};
+
+// one "latency <what>: n=... p50=..." line, nothing if h is empty
+void dumpHistogram(std::ostream &out, const char *what, const CLatencyHistogram &h);
+
+#endif
@@ -22,11 +22,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/types.h>
 #ifdef _WIN32
 #include <winsock.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -207,6 +209,7 @@ public:
     int Send = 0;
     int Sent = 0;
     int Left = m_Payload.size();
+#ifdef _WIN32
     for (int Package = 1; Package <= NbrOfPackages; Package++)
     {
       if (Left > MAX_PAYLOAD_SIZE)
@@ -236,48 +239,103 @@ public:
 
       Sent += Send;
     }
+#else
+    /* Each fragment is sent as an iovec pair of its own header and a slice
+       of m_Payload, and up to SEND_BATCH fragments go out per sendmmsg(),
+       so large HELO/NOTIFICATION payloads are neither copied nor sent one
+       syscall per fragment. */
+    char Headers[SEND_BATCH][HEADER_SIZE];
+    struct iovec Iov[SEND_BATCH][2];
+    struct mmsghdr Msgs[SEND_BATCH];
+    int Package = 1;
+    while (Package <= NbrOfPackages && SendSuccessfull)
+    {
+      int Batch = 0;
+      for (; Batch < SEND_BATCH && Package <= NbrOfPackages; Batch++, Package++)
+      {
+        Send = Left > MAX_PAYLOAD_SIZE ? MAX_PAYLOAD_SIZE : Left;
+        Left -= Send;
+
+        ConstructHeader(m_PacketType, NbrOfPackages, Package, Send, UID, Headers[Batch]);
+        Iov[Batch][0].iov_base = Headers[Batch];
+        Iov[Batch][0].iov_len = HEADER_SIZE;
+        Iov[Batch][1].iov_base = Send ? &m_Payload[Sent] : NULL;
+        Iov[Batch][1].iov_len = Send;
+
+        memset(&Msgs[Batch], 0, sizeof(Msgs[Batch]));
+        Msgs[Batch].msg_hdr.msg_name = (void *)Addr.GetAddress();
+        Msgs[Batch].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        Msgs[Batch].msg_hdr.msg_iov = Iov[Batch];
+        Msgs[Batch].msg_hdr.msg_iovlen = 2;
+
+        Sent += Send;
+      }
+
+      for (int Done = 0; Done < Batch; )
+      {
+        int rtn = sendmmsg(Socket, Msgs + Done, Batch - Done, 0);
+        if (rtn <= 0)
+        {
+          SendSuccessfull = false;
+          break;
+        }
+        for (int i = Done; i < Done + rtn; i++)
+          if (Msgs[i].msg_len != HEADER_SIZE + Iov[i][1].iov_len)
+            SendSuccessfull = false;
+        Done += rtn;
+      }
+    }
+#endif
     return SendSuccessfull;
   }
+
+  // Encodes a message that fits into a single datagram, for callers that
+  // send the same packet over and over. Returns its length or -1.
+  int Encode(char *Buffer, int Size, unsigned int UID = XBMCClientUtils::GetUniqueIdentifier())
+  {
+    if (m_Payload.size() == 0)
+      ConstructPayload();
+    int Length = HEADER_SIZE + m_Payload.size();
+    if (m_Payload.size() > MAX_PAYLOAD_SIZE || Length > Size)
+      return -1;
+
+    ConstructHeader(m_PacketType, 1, 1, m_Payload.size(), UID, Buffer);
+    memcpy(Buffer + HEADER_SIZE, &m_Payload[0], m_Payload.size());
+    return Length;
+  }
+
+  // The header of fragment CurrentPacket (counting from 1) of a message,
+  // for callers that assemble the payload fragments themselves.
+  static void EncodeHeader(int PacketType, int NumberOfPackets, int CurrentPacket, unsigned short PayloadSize, char *Header, unsigned int UID = XBMCClientUtils::GetUniqueIdentifier())
+  {
+    ConstructHeader(PacketType, NumberOfPackets, CurrentPacket, PayloadSize, UID, Header);
+  }
 protected:
   char            m_Header[HEADER_SIZE];
   unsigned short  m_PacketType;
 
   std::vector<char> m_Payload;
 
+  static const int SEND_BATCH = 16;
+
   static void ConstructHeader(int PacketType, int NumberOfPackets, int CurrentPacket, unsigned short PayloadSize, unsigned int UniqueToken, char *Header)
   {
-    sprintf(Header, "XBMC");
-    for (int i = 4; i < HEADER_SIZE; i++)
-      Header[i] = 0;
+    // fixed-width big-endian stores, the reserved tail stays zero
+    uint16_t Type     = htons(CurrentPacket == 1 ? PacketType : PT_BLOB);
+    uint32_t Sequence = htonl(CurrentPacket);
+    uint32_t Count    = htonl(NumberOfPackets);
+    uint16_t Size     = htons(PayloadSize);
+    uint32_t Token    = htonl(UniqueToken);
+
+    memcpy(Header, "XBMC", 4);
     Header[4]  = MAJOR_VERSION;
     Header[5]  = MINOR_VERSION;
-    if (CurrentPacket == 1)
-    {
-      Header[6]  = ((PacketType & 0xff00) >> 8);
-      Header[7]  =  (PacketType & 0x00ff);
-    }
-    else
-    {
-      Header[6]  = ((PT_BLOB & 0xff00) >> 8);
-      Header[7]  =  (PT_BLOB & 0x00ff);
-    }
-    Header[8]  = ((CurrentPacket & 0xff000000) >> 24);
-    Header[9]  = ((CurrentPacket & 0x00ff0000) >> 16);
-    Header[10] = ((CurrentPacket & 0x0000ff00) >> 8);
-    Header[11] =  (CurrentPacket & 0x000000ff);
-
-    Header[12] = ((NumberOfPackets & 0xff000000) >> 24);
-    Header[13] = ((NumberOfPackets & 0x00ff0000) >> 16);
-    Header[14] = ((NumberOfPackets & 0x0000ff00) >> 8);
-    Header[15] =  (NumberOfPackets & 0x000000ff);
-
-    Header[16] = ((PayloadSize & 0xff00) >> 8);
-    Header[17] =  (PayloadSize & 0x00ff);
-
-    Header[18] = ((UniqueToken & 0xff000000) >> 24);
-    Header[19] = ((UniqueToken & 0x00ff0000) >> 16);
-    Header[20] = ((UniqueToken & 0x0000ff00) >> 8);
-    Header[21] =  (UniqueToken & 0x000000ff);
+    memcpy(Header + 6, &Type, 2);
+    memcpy(Header + 8, &Sequence, 4);
+    memcpy(Header + 12, &Count, 4);
+    memcpy(Header + 16, &Size, 2);
+    memcpy(Header + 18, &Token, 4);
+    memset(Header + 22, 0, HEADER_SIZE - 22);
   }
 
   virtual void ConstructPayload()
@@ -753,76 +811,94 @@ public:
       m_UID = XBMCClientUtils::GetUniqueIdentifier();
   }
 
-  void SendNOTIFICATION(const char *Title, const char *Message, unsigned short IconType, const char *IconFile = NULL)
+  bool SendNOTIFICATION(const char *Title, const char *Message, unsigned short IconType, const char *IconFile = NULL)
   {
     if (m_Socket < 0)
-      return;
+      return false;
 
     CPacketNOTIFICATION notification(Title, Message, IconType, IconFile);
-    notification.Send(m_Socket, m_Addr, m_UID);
+    return notification.Send(m_Socket, m_Addr, m_UID);
   }
 
-  void SendHELO(const char *DevName, unsigned short IconType, const char *IconFile = NULL)
+  bool SendPING()
   {
     if (m_Socket < 0)
-      return;
+      return false;
+
+    CPacketPING ping;
+    return ping.Send(m_Socket, m_Addr, m_UID);
+  }
+
+  bool SendBYE()
+  {
+    if (m_Socket < 0)
+      return false;
+
+    CPacketBYE bye;
+    return bye.Send(m_Socket, m_Addr, m_UID);
+  }
+
+  bool SendHELO(const char *DevName, unsigned short IconType, const char *IconFile = NULL)
+  {
+    if (m_Socket < 0)
+      return false;
 
     CPacketHELO helo(DevName, IconType, IconFile);
-    helo.Send(m_Socket, m_Addr, m_UID);
+    return helo.Send(m_Socket, m_Addr, m_UID);
   }
 
-  void SendButton(const char *Button, const char *DeviceMap, unsigned short Flags, unsigned short Amount = 0)
+  bool SendButton(const char *Button, const char *DeviceMap, unsigned short Flags, unsigned short Amount = 0)
   {
     if (m_Socket < 0)
-      return;
+      return false;
 
     CPacketBUTTON button(Button, DeviceMap, Flags, Amount);
-    button.Send(m_Socket, m_Addr, m_UID);
+    return button.Send(m_Socket, m_Addr, m_UID);
   }
 
-  void SendButton(unsigned short ButtonCode, const char *DeviceMap, unsigned short Flags, unsigned short Amount = 0)
+  bool SendButton(unsigned short ButtonCode, const char *DeviceMap, unsigned short Flags, unsigned short Amount = 0)
   {
     if (m_Socket < 0)
-      return;
+      return false;
 
     CPacketBUTTON button(ButtonCode, DeviceMap, Flags, Amount);
-    button.Send(m_Socket, m_Addr, m_UID);
+    return button.Send(m_Socket, m_Addr, m_UID);
   }
 
-  void SendButton(unsigned short ButtonCode, unsigned Flags, unsigned short Amount = 0)
+  bool SendButton(unsigned short ButtonCode, unsigned Flags, unsigned short Amount = 0)
   {
     if (m_Socket < 0)
-      return;
+      return false;
 
     CPacketBUTTON button(ButtonCode, Flags, Amount);
-    button.Send(m_Socket, m_Addr, m_UID);
+    return button.Send(m_Socket, m_Addr, m_UID);
   }
 
-  void SendMOUSE(int X, int Y, unsigned char Flag = MS_ABSOLUTE)
+  bool SendMOUSE(int X, int Y, unsigned char Flag = MS_ABSOLUTE)
   {
     if (m_Socket < 0)
-      return;
+      return false;
 
     CPacketMOUSE mouse(X, Y, Flag);
-    mouse.Send(m_Socket, m_Addr, m_UID);
+    return mouse.Send(m_Socket, m_Addr, m_UID);
   }
 
-  void SendLOG(int LogLevel, const char *Message, bool AutoPrintf = true)
+  bool SendLOG(int LogLevel, const char *Message, bool AutoPrintf = true)
   {
     if (m_Socket < 0)
-      return;
+      return false;
 
     CPacketLOG log(LogLevel, Message, AutoPrintf);
-    log.Send(m_Socket, m_Addr, m_UID);
+    return log.Send(m_Socket, m_Addr, m_UID);
   }
 
-  void SendACTION(const char *ActionMessage, int ActionType = ACTION_EXECBUILTIN)
+  bool SendACTION(const char *ActionMessage, int ActionType = ACTION_EXECBUILTIN)
   {
     if (m_Socket < 0)
-      return;
+      return false;
 
     CPacketACTION action(ActionMessage, ActionType);
-    action.Send(m_Socket, m_Addr, m_UID);
+    return action.Send(m_Socket, m_Addr, m_UID);
   }
 };
 
@@ -20,7 +20,11 @@
  */
 
 #include "libcec/cec.h"
-#include "lib/xbmcclient.h"
+#include "keyhandler.h"
+#include "metrics.h"
+#include "configwatch.h"
+#include "keymapcache.h"
+#include "reactor.h"
 #include <cstdio>
 #include <fcntl.h>
 #include <iostream>
@@ -28,423 +32,339 @@
 #include <string>
 #include <sstream>
 #include <signal.h>
+#include <sys/signalfd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <map>
+#include <set>
+#include <vector>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <pulse/pulseaudio.h>
 #include <exception>
 #include <stdexcept>
+#include <thread>
 
 using namespace CEC;
 using namespace std;
 
 #define CEC_CONFIG_VERSION CEC_CLIENT_VERSION_CURRENT;
-#define HOST "127.0.0.1"
-#define DEFAULT_PORT 9090
+#define DEFAULT_METRICS_PATH "/var/run/cecanyway.sock"
+#define CACHE_SUFFIX ".cache"
 
 #include "libcec/cecloader.h"
 
+// an adapter given with -a, empty fields take the defaults
+struct adapter_binding
+{
+  string                comm;
+  string                configPath;
+  vector<xbmc_endpoint> targets;
+};
 
-class pulseaudio {
-private:
-    pa_context *context;
-    pa_mainloop *mainloop;
-    pa_mainloop_api *mainloop_api;
-    bool success;
-    static const int SINK_INDEX = 1;
-    static const pa_volume_t MAX_VOLUME = PA_VOLUME_NORM * 2;
-    float volume_amount;
-    bool toggle_mute;
-    float result;
-    string error;
-
-
-    bool volume_relative_adjust(pa_cvolume *cv) {
-        /* Relative volume change is additive in case of a PERCENTAGE */
-        pa_volume_t v = pa_cvolume_avg(cv);
-        bool up = volume_amount >= 0;
-        if (!up)
-               volume_amount = -volume_amount;
-        pa_volume_t adjustment = (volume_amount * PA_VOLUME_NORM);
-        if (adjustment == 0) {
-            result = (float)v / PA_VOLUME_NORM;
-            return false;
-        } else {
-            if (up)
-                v = v+adjustment < PA_VOLUME_MUTED ? PA_VOLUME_MUTED : v + adjustment;
-            else
-                v = (int32_t)v-(int32_t)adjustment < PA_VOLUME_MUTED ? PA_VOLUME_MUTED : v - adjustment;
-            if (v > MAX_VOLUME)
-        up ? v = MAX_VOLUME : v = PA_VOLUME_MUTED;
-            pa_cvolume_set(cv, 1, v);
-            result = (float) v / PA_VOLUME_NORM;
-            return true;
-        }
-    }
-
-    static void context_drain_complete(pa_context *c, void *userdata) {
-        pa_context_disconnect(((pulseaudio *)userdata)->context);
-    }
+struct target_watch;
 
-    void done_callback(pa_context *c, int success, void *userdata) {
-        pa_operation *o;
-        if (!success) {
-            error += "PulseAudio error: ";
-            error += pa_strerror(pa_context_errno(c));
-            return;
-        } else
-            this->success = true;
-
-        if (!(o = pa_context_drain(context, context_drain_complete, this)))
-            pa_context_disconnect(context);
-        else
-            pa_operation_unref(o);
-    }
-    static void static_done_callback(pa_context *c, int success, void *userdata) {
-        ((pulseaudio *)userdata)->done_callback(c, success, NULL);
-    }
+// a transport's socket as last registered with the reactor
+struct transport_watch
+{
+  int           fd;
+  unsigned int  generation;
+  target_watch *owner;
+};
 
-    void get_sink_volume_callback(pa_context *c, const pa_sink_info *i, int is_last, void *userdata) {
+// the sockets of one target, which reconnects on its own sender thread
+struct target_watch
+{
+  CXbmcTarget     *target;
+  transport_watch  eventServer;
+  transport_watch  rpcClient;
+};
 
-        if (is_last < 0) {
-            error += "PulseAudio error Failed to get sink information: ";
-            error += pa_strerror(pa_context_errno(c));
-            return;
-        }
-        if (is_last)
-            return;
-        assert(i);
-        if (toggle_mute) {
-            result = !i->mute;
-            pa_operation_unref(pa_context_set_sink_mute_by_index(c, i->index, !i->mute, static_done_callback, this));
-        } else {
-            pa_cvolume cv = i->volume;
-            if (volume_relative_adjust(&cv))
-                // We changed the volume
-                pa_operation_unref(pa_context_set_sink_volume_by_index(c, i->index, &cv, static_done_callback, this));
-            else
-                // It remained the same
-                done_callback(c, 1, NULL);
-        }
-    }
-    static void static_get_sink_volume_callback(pa_context *c, const pa_sink_info *i, int is_last, void *userdata) {
-        ((pulseaudio *)userdata)->get_sink_volume_callback(c, i, is_last, NULL);
+// one libcec instance per adapter, its key presses go to its own context
+struct cec_instance
+{
+  ICECCallbacks         callbacks;
+  libcec_configuration  configuration;
+  ICECAdapter          *parser;
+  CKeyContext          *context;
+};
+
+bool                    daemonize;
+string                  configFilePath;
+bool                    compileConfig;
+unsigned int            rpcPort = DEFAULT_PORT;
+string                  metricsPath = DEFAULT_METRICS_PATH;
+vector<xbmc_endpoint>   defaultTargets;
+vector<adapter_binding> bindings;
+vector<cec_instance *>  instances;
+vector<target_watch *>  targetWatches;
+vector<CConfigWatcher *> configWatchers;
+CMetricsServer          metrics;
+CReactor                reactor;
+int                     signalFd = -1;
+
+void onSignal(void *context, uint32_t events)
+{
+  struct signalfd_siginfo info;
+  while (read(signalFd, &info, sizeof(info)) == sizeof(info))
+  {
+    if (info.ssi_signo == SIGUSR1)
+      dumpLatency(cout);
+    else
+    {
+      cout << "signal caught: " << info.ssi_signo << " - exiting" << endl;
+      reactor.Stop();
     }
+  }
+}
 
-    void cb_pulse_state(pa_context *c, void *userdata) {
-        assert(c);
-        switch (pa_context_get_state(c)) {
-
-        case PA_CONTEXT_READY:
-            // Do what we want here!!
-            pa_operation_unref(pa_context_get_sink_info_by_index(c, SINK_INDEX, static_get_sink_volume_callback, this));
-
-        break;
-        case PA_CONTEXT_FAILED:
-            error += "PulseAudio error Connection failure: ";
-            error += pa_strerror(pa_context_errno(c));
-        break;
-        case PA_CONTEXT_TERMINATED:
-            pa_mainloop_quit(mainloop, 0);
-        }
-    }
-    static void static_cb_pulse_state(pa_context *c, void *userdata) {
-        ((pulseaudio *)userdata)->cb_pulse_state(c, NULL);
-    }
+void onEventServer(void *watch, uint32_t events);
+void onRpcClient(void *watch, uint32_t events);
 
-    void init_pulse() {
-        success = false;
-        if (!(mainloop = pa_mainloop_new())) {
-            throw runtime_error("Cannot create pulse mainloop");
-        }
-        mainloop_api = pa_mainloop_get_api(mainloop);
-        if (!(context = pa_context_new(mainloop_api, NULL))) {
-            throw runtime_error("Cannot start pulse mainloop");
-        }
-        pa_context_set_state_callback(context, static_cb_pulse_state, this);
-        if (pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
-            throw runtime_error("pa_context_connect() failed");
-        }
-    }
+// the transports reconnect on their own, follow them to their new sockets
+void watchTransport(transport_watch &watch, int fd, unsigned int generation, CReactor::Handler handler)
+{
+  if (fd == watch.fd && generation == watch.generation)
+    return;
+  // the old descriptor may have been closed and reused by another transport
+  if (reactor.Context(watch.fd) == &watch)
+    reactor.Remove(watch.fd);
+  watch.fd = reactor.Add(fd, handler, &watch) ? fd : -1;
+  watch.generation = generation;
+}
 
-    void destroy_pulse() {
-        if (mainloop)
-            pa_mainloop_free(mainloop);
-        mainloop = NULL;
-        if (context)
-            pa_context_unref(context);
-        context = NULL;
-    }
+void syncTransports(target_watch &watch)
+{
+  unsigned int generation;
+  int fd = watch.target->EventServer().Fd(generation);
+  watchTransport(watch.eventServer, fd, generation, &onEventServer);
+  fd = watch.target->RpcClient().Fd(generation);
+  watchTransport(watch.rpcClient, fd, generation, &onRpcClient);
+}
 
-    void exectute_task() {
-        int ret;
-        error.clear();
-        result = -1.0;
-        init_pulse();
-        if (pa_mainloop_run(mainloop, &ret) < 0) {
-            throw runtime_error("pa_mainloop_run() failed.");
-        }
-        // Reset pulse
-        destroy_pulse();
-    }
+void onEventServer(void *watch, uint32_t events)
+{
+  target_watch &owner = *((transport_watch *)watch)->owner;
+  owner.target->EventServer().Drain();
+  syncTransports(owner);
+}
 
-public:
-    pulseaudio(){
-        success = false;
-        volume_amount = 0.0;
-        toggle_mute = false;
-        mainloop = NULL;
-        context = NULL;
-        mainloop_api = NULL;
-    }
+void onRpcClient(void *watch, uint32_t events)
+{
+  target_watch &owner = *((transport_watch *)watch)->owner;
+  owner.target->RpcClient().Drain();
+  syncTransports(owner);
+}
 
-    ~pulseaudio() {
-        destroy_pulse();
-    }
+// the targets keep their connections alive, this only follows their sockets
+void onTick(void *context, uint32_t events)
+{
+  for (unsigned int i = 0; i < targetWatches.size(); i++)
+    syncTransports(*targetWatches[i]);
+}
 
-    float modify_volume(float percent) {
-        volume_amount = percent;
-        exectute_task();
-        volume_amount = 0.0;
-        if (!error.empty()) {
-            throw runtime_error(error);
-        }
-        return result;
-    }
+void onMetrics(void *context, uint32_t events)
+{
+  metrics.Serve();
+}
 
-    bool togglemute() {
-        toggle_mute = true;
-        exectute_task();
-        toggle_mute = false;
-        if (!error.empty()) {
-            throw runtime_error(error);
-        }
-        return result != 0.0;
-    }
-} pulse;
-
-ICECCallbacks        callbacks;
-libcec_configuration configuration;
-string               port;
-bool                 aborted;
-bool                 daemonize;
-bool                 logEvents;
-string               configFilePath;
-unsigned int         rpcPort = DEFAULT_PORT;
-map<int, string>     keyMap;
-map<int, string>     eventMap;
-
-void populateKeyMapDefault()
+void onConfigChange(void *watcher, uint32_t events)
 {
-  /* NOT USED */
-  keyMap[CEC_USER_CONTROL_CODE_LEFT] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Left\"}";
-  keyMap[CEC_USER_CONTROL_CODE_RIGHT] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Right\"}";
-  keyMap[CEC_USER_CONTROL_CODE_DOWN] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Down\"}";
-  keyMap[CEC_USER_CONTROL_CODE_UP] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Up\"}";
-  keyMap[CEC_USER_CONTROL_CODE_SELECT] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Select\"}";
-  keyMap[CEC_USER_CONTROL_CODE_EXIT] = "{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"Input.Back\"}";
-  keyMap[CEC_USER_CONTROL_CODE_PLAY] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.PlayPause\", \"params\": { \"playerid\": 1 }, \"id\": 1}";
-  keyMap[CEC_USER_CONTROL_CODE_STOP] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Stop\", \"params\": { \"playerid\": 1 }, \"id\": 1}";
-  keyMap[CEC_USER_CONTROL_CODE_PAUSE] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.PlayPause\", \"params\": { \"playerid\": 1 }, \"id\": 1}";
-  keyMap[CEC_USER_CONTROL_CODE_REWIND] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Seek\", \"params\": { \"playerid\": 1, \"value\": \"smallbackward\" }, \"id\": 1}";
-  keyMap[CEC_USER_CONTROL_CODE_BACKWARD] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Seek\", \"params\": { \"playerid\": 1, \"value\": \"bigbackward\" }, \"id\": 1}";
-  keyMap[CEC_USER_CONTROL_CODE_FAST_FORWARD] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Seek\", \"params\": { \"playerid\": 1, \"value\": \"smallforward\" }, \"id\": 1}";
-  keyMap[CEC_USER_CONTROL_CODE_FORWARD] = "{\"jsonrpc\": \"2.0\", \"method\": \"Player.Seek\", \"params\": { \"playerid\": 1, \"value\": \"bigforward\" }, \"id\": 1}";
-
-  /* USED */
-  keyMap[CEC_USER_CONTROL_CODE_CLEAR] = "{\"jsonrpc\": \"2.0\", \"method\": \"Input.Home\", \"id\": 1}";
-  keyMap[CEC_USER_CONTROL_CODE_ELECTRONIC_PROGRAM_GUIDE] = "{\"jsonrpc\": \"2.0\", \"method\": \"GUI.SetFullscreen\", \"params\": { \"name\": \"fullscreen\", \"value\": \"toggle\" }, \"id\": 1}";
+  ((CConfigWatcher *)watcher)->OnChange();
 }
 
-void populateEventMapDefault()
+void onConfigSettled(void *watcher, uint32_t events)
 {
-  eventMap[CEC_USER_CONTROL_CODE_LEFT] = "left";
-  eventMap[CEC_USER_CONTROL_CODE_RIGHT] = "right";
-  eventMap[CEC_USER_CONTROL_CODE_DOWN] = "down";
-  eventMap[CEC_USER_CONTROL_CODE_UP] = "up";
-  eventMap[CEC_USER_CONTROL_CODE_SELECT] = "select";
-  eventMap[CEC_USER_CONTROL_CODE_EXIT] = "back";
-  eventMap[CEC_USER_CONTROL_CODE_PLAY] = "play";
-  eventMap[CEC_USER_CONTROL_CODE_STOP] = "stop";
-  eventMap[CEC_USER_CONTROL_CODE_PAUSE] = "pause";
-  eventMap[CEC_USER_CONTROL_CODE_REWIND] = "reverse";
-  eventMap[CEC_USER_CONTROL_CODE_BACKWARD] = "skipminus";
-  eventMap[CEC_USER_CONTROL_CODE_FAST_FORWARD] = "forward";
-  eventMap[CEC_USER_CONTROL_CODE_FORWARD] = "skipplus";
-  // eventMap[CEC_USER_CONTROL_CODE_F1_BLUE] = "blue";
-  eventMap[CEC_USER_CONTROL_CODE_F2_RED] = "red";
-  eventMap[CEC_USER_CONTROL_CODE_F3_GREEN] = "green";
-  eventMap[CEC_USER_CONTROL_CODE_F4_YELLOW] = "yellow";
-  eventMap[CEC_USER_CONTROL_CODE_SETUP_MENU] = "title";
-  eventMap[CEC_USER_CONTROL_CODE_ELECTRONIC_PROGRAM_GUIDE] = "backslash";
-
-  eventMap[CEC_USER_CONTROL_CODE_CHANNEL_UP] = "pageplus";
-  eventMap[CEC_USER_CONTROL_CODE_CHANNEL_DOWN] = "pageminus";
+  ((CConfigWatcher *)watcher)->OnSettled();
 }
-void showxbmcalert(string title, string message, string image="", int displaytime=0);
 
-int CecKeyPressCB(void*, const cec_keypress key)
+void setupPulse()
 {
   try {
-  std::cout<<"Key press "<<key.keycode<<" " << key.duration<<std::endl;
-  if (key.duration == 0 || key.keycode == CEC_USER_CONTROL_CODE_STOP)
-  {
-    string json = "unmapped";
-
-    if (key.keycode == CEC_USER_CONTROL_CODE_VOLUME_UP)
-    {
-        float vol = pulse.modify_volume(0.10);
-        stringstream ssvol;
-        ssvol<<"Volume "<<int(vol*100)<<"%";
-        showxbmcalert(ssvol.str(), "Volume increased", "VolumeIcon.png");
-    }
-    else if (key.keycode == CEC_USER_CONTROL_CODE_VOLUME_DOWN)
-    {
-      float vol = pulse.modify_volume(-0.10);
-      stringstream ssvol;
-      ssvol<<"Volume "<<int(vol*100)<<"%";
-      showxbmcalert(ssvol.str(), "Volume decreased", "VolumeIcon.png");
-    }
-    else if (key.keycode == CEC_USER_CONTROL_CODE_MUTE)
-    {
-      bool mute = pulse.togglemute();
-      stringstream ssvol;
-      ssvol<<"Volume "<<int(pulse.modify_volume(0.0)*100)<<"%";
-      showxbmcalert(mute?"Volume Muted":"Volume Unmuted", ssvol.str(), "VolumeIcon.png");
-    }
-    else if (key.keycode == CEC_USER_CONTROL_CODE_F1_BLUE)
-    {
-      system("returntodesktop.sh");
-    }
-    else if (eventMap.find(key.keycode) != eventMap.end())
-    {
-      /* connect to localhost, port 9777 using a UDP socket
-         this only needs to be done once.
-         by default this is where XBMC will be listening for incoming
-         connections. */
-      CAddress my_addr; // Address => localhost on 9777
-      int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-      if (sockfd < 0)
-      {
-        cout << "error creating socket" << endl;
-        return 1;
-      }
-
-      my_addr.Bind(sockfd);
-
-      if (key.keycode == CEC_USER_CONTROL_CODE_ELECTRONIC_PROGRAM_GUIDE) {
-        CPacketBUTTON btn1(eventMap[key.keycode].c_str(), "KB", BTN_DOWN | BTN_USE_NAME | BTN_QUEUE);
-        btn1.Send(sockfd, my_addr);
-
-        CPacketBUTTON btn2(eventMap[key.keycode].c_str(), "KB", BTN_UP | BTN_USE_NAME | BTN_QUEUE | BTN_NO_REPEAT);
-        btn2.Send(sockfd, my_addr);
-      }
-      else
-      {
-        CPacketBUTTON btn1(eventMap[key.keycode].c_str(), "R1", BTN_DOWN | BTN_USE_NAME | BTN_QUEUE);
-        btn1.Send(sockfd, my_addr);
-
-        CPacketBUTTON btn2(eventMap[key.keycode].c_str(), "R1", BTN_UP | BTN_USE_NAME | BTN_QUEUE | BTN_NO_REPEAT);
-        btn2.Send(sockfd, my_addr);
-      }
-
-      shutdown(sockfd, SHUT_WR);
-      close(sockfd);
-
-    }
-    else if (keyMap.find(key.keycode) != keyMap.end())
-    {
-      json = keyMap[key.keycode];
-
-      int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-      if (sockfd < 0)
-      {
-        cout << "error opening socket" << endl;
-        return 1;
-      }
-
-      struct sockaddr_in serv_addr;
-      memset(&serv_addr, '0', sizeof(serv_addr));
-      serv_addr.sin_family = AF_INET;
-      inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr);
-      serv_addr.sin_port = htons(rpcPort);
-
-      if (connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(struct sockaddr_in)) < 0)
-      {
-        cout << "error connecting to 127.0.0.1:" << rpcPort << endl;
-        return 1;
-      }
+    pulse.connect();
+    pulse.reset_stream_volumes();
+  } catch (exception &e) {
+    cerr << e.what() << endl;
+  }
+}
 
-      write(sockfd, json.c_str(), json.length());
+// <host>[:<json-rpc port>[:<event server port>]]
+bool parseEndpoint(const string &arg, xbmc_endpoint &endpoint)
+{
+  vector<string> fields;
+  stringstream ss(arg);
+  string field;
+  while (getline(ss, field, ':'))
+    fields.push_back(field);
+  if (fields.empty() || fields.size() > 3 || fields[0].empty())
+    return false;
+
+  endpoint.rpcPort = 0;
+  endpoint.eventPort = 0;
+  for (unsigned int i = 1; i < fields.size(); i++)
+  {
+    int port = atoi(fields[i].c_str());
+    if ((port < 1) || (port > 0xffff))
+      return false;
+    (i == 1 ? endpoint.rpcPort : endpoint.eventPort) = port;
+  }
 
-      shutdown(sockfd, SHUT_WR);
+  // a name is resolved once here, so both transports reach the same address
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *info;
+  if (getaddrinfo(fields[0].c_str(), NULL, &hints, &info) != 0)
+  {
+    cout << "unable to resolve xbmc host " << fields[0] << endl;
+    return false;
+  }
+  char address[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &((struct sockaddr_in *)info->ai_addr)->sin_addr, address, sizeof(address));
+  freeaddrinfo(info);
+  endpoint.host = address;
+  return true;
+}
 
-      close(sockfd);
-    }
+// <port>[,<config>[,<target>[+<target>...]]]
+bool parseBinding(const string &arg, adapter_binding &binding)
+{
+  vector<string> fields;
+  stringstream ss(arg);
+  string field;
+  while (getline(ss, field, ','))
+    fields.push_back(field);
+  if (fields.empty() || fields.size() > 3 || fields[0].empty())
+    return false;
+
+  binding.comm = fields[0];
+  binding.configPath = fields.size() > 1 ? fields[1] : "";
+  binding.targets.clear();
+  if (fields.size() < 3)
+    return true;
+
+  stringstream targets(fields[2]);
+  while (getline(targets, field, '+'))
+  {
+    xbmc_endpoint endpoint;
+    if (!parseEndpoint(field, endpoint))
+      return false;
+    binding.targets.push_back(endpoint);
+  }
+  return !binding.targets.empty();
+}
 
-    if (logEvents)
-      cout << "keycode: " << key.keycode << ", xbmc command: " << json << endl;
+// what -a said about the adapter on comm, the defaults for the rest
+adapter_binding bindingFor(const string &comm)
+{
+  adapter_binding binding;
+  binding.comm = comm;
+  for (unsigned int i = 0; i < bindings.size(); i++)
+    if (bindings[i].comm == comm)
+      binding = bindings[i];
+
+  if (binding.configPath.empty())
+    binding.configPath = configFilePath;
+  if (binding.targets.empty())
+    binding.targets = defaultTargets;
+  if (binding.targets.empty())
+  {
+    xbmc_endpoint local = { HOST, 0, 0 };
+    binding.targets.push_back(local);
   }
-  } catch (exception e) {
-     cerr<<"Error while handling keycode:"<<key.keycode<<" - "<<e.what()<<endl;
+  for (unsigned int i = 0; i < binding.targets.size(); i++)
+  {
+    if (binding.targets[i].rpcPort == 0)
+      binding.targets[i].rpcPort = rpcPort;
+    if (binding.targets[i].eventPort == 0)
+      binding.targets[i].eventPort = STD_PORT;
   }
-
-  return 0;
+  return binding;
 }
 
-void showxbmcalert(string title, string message, string image, int displaytime) {
-    string json = "{\"jsonrpc\": \"2.0\", \"method\": \"GUI.ShowNotification\", \"params\": {";
-    json += "\"title\":\"" + title + "\"";
-    json += ",\"message\":\"" + message + "\"";
-    if (displaytime) {
-        json += ",\"displaytime:\"";
-        json += displaytime;
-    }
-    if (!image.empty()) {
-        json += ",\"image\":\"";
-        json += image;
-        json += "\"";
-    }
-
-    json += "}, \"id\": 1}";
-    cout<<json;
+set<string> configPaths()
+{
+  set<string> paths;
+  paths.insert(configFilePath);
+  for (unsigned int i = 0; i < bindings.size(); i++)
+    if (!bindings[i].configPath.empty())
+      paths.insert(bindings[i].configPath);
+  return paths;
+}
 
-    struct sockaddr_in serv_addr;
-    int sockfd = -1;
-    memset(&serv_addr, '0', sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    inet_pton(AF_INET, HOST, &serv_addr.sin_addr);
-    serv_addr.sin_port = htons(rpcPort);
+ICECAdapter *initialiseLibCec(libcec_configuration &configuration, ICECCallbacks &callbacks, void *context)
+{
+  configuration.Clear();
+  callbacks.Clear();
+  snprintf(configuration.strDeviceName, 13, "cecanyway");
+  configuration.clientVersion = CEC_CONFIG_VERSION;
+  configuration.bActivateSource = 0;
+  if (context)
+  {
+    callbacks.CBCecKeyPress = &CecKeyPressCB;
+    configuration.callbackParam = context;
+  }
+  configuration.callbacks = &callbacks;
 
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        cout << "error opening socket:" << rpcPort << endl;
-        return;
-    }
-    if (connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(struct sockaddr_in)) < 0)
-    {
-        cout << "error connecting to " HOST ":" << rpcPort << endl;
-        return;
-    }
+  configuration.deviceTypes.Add(CEC_DEVICE_TYPE_PLAYBACK_DEVICE);
+  configuration.deviceTypes.Add(CEC_DEVICE_TYPE_AUDIO_SYSTEM);
+  return LibCecInitialise(&configuration);
+}
 
-    write(sockfd, json.c_str(), json.length());
-    close(sockfd);
+// UnloadLibCec() also closes the library all instances share, so only the
+// last one goes through it, the others are destroyed directly
+void destroyLibCec(ICECAdapter *parser, bool last)
+{
+  if (last)
+    UnloadLibCec(parser);
+  else
+    delete parser;
 }
 
-void sighandler(int iSignal)
+// opens the adapter on comm with its own libcec instance and context
+cec_instance *openAdapter(const string &comm, const map<string, CKeyTable *> &tables)
 {
-  cout << "signal caught: " <<  iSignal << " - exiting" << endl;
-  aborted = true;
+  adapter_binding binding = bindingFor(comm);
+  cec_instance *instance = new cec_instance;
+  instance->context = new CKeyContext(comm, binding.configPath, binding.targets);
+  publishKeyTable(*instance->context, new CKeyTable(*tables.find(binding.configPath)->second));
+
+  instance->parser = NULL;
+  if (!instance->context->Start())
+    cout << "unable to start the key handler threads for the adapter on " << comm << endl;
+  else
+  {
+    instance->parser = initialiseLibCec(instance->configuration, instance->callbacks, instance->context);
+
+    cout << "opening a connection to the CEC adapter on " << comm << "..." << endl;
+    if (instance->parser && instance->parser->Open(comm.c_str()))
+      return instance;
+
+    cout << "unable to open the device on port " << comm << endl;
+  }
+
+  if (instance->parser)
+    destroyLibCec(instance->parser, false);
+  delete instance->context;
+  delete instance;
+  return NULL;
 }
 
 void parseOptions(int argc, char* argv[])
 {
   stringstream ss;
   ss << argv[0];
-  ss << " [-d] (daemonize) [-l] (log keypresses) [-f <path>] (path to config file) [-p <port>] (xbmc json-rpc port) [-h] (help)";
+  ss << " [-d] (daemonize) [-l] (log keypresses) [-f <path>] (path to config file) [-p <port>] (xbmc json-rpc port)";
+  ss << " [-w <ms>] (volume key coalescing window) [-o <ms>] (minimum interval between volume notifications) [-m <path>] (metrics socket)";
+  ss << " [-n jsonrpc|eventserver] (how notifications are sent) [-i <png|jpg|gif>] (icon for event server notifications)";
+  ss << " [-r native|soft|off] (repeat held navigation keys in xbmc, with an accelerating timer or not at all)";
+  ss << " [-t <host>[:<port>[:<event server port>]]] (xbmc to control, repeatable)";
+  ss << " [-a <port>[,<config>[,<target>[+<target>...]]]] (key map and xbmc for one adapter, repeatable)";
+  ss << " [--compile-config] (write the key map cache and exit) [-h] (help)";
   string usage = ss.str();
 
   for (int i = 1; i < argc; i++)
@@ -480,51 +400,128 @@ void parseOptions(int argc, char* argv[])
         }
       }
     }
-    else
+    else if (strcmp(argv[i], "-w") == 0)
     {
-      cout << usage << endl;
-      exit((strcmp(argv[i], "-h") == 0) ? 0 : 1);
+      if (++i == argc)
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+      else
+      {
+        int window = atoi(argv[i]);
+        if ((window < 0) || (window > 10000))
+        {
+          cout << usage << endl;
+          exit(1);
+        }
+        volumeWindow = window;
+      }
     }
-  }
-}
-
-void populateKeyMapFromFile(ifstream &file)
-{
-  stringstream ss;
-
-  bool error = false;
-  int i = 1;
-  while (file.good())
-  {
-    unsigned int keycode;
-    string assignLiteral = "=>";
-    string literal;
-    string json;
-
-    if (!(file >> keycode))
+    else if (strcmp(argv[i], "-o") == 0)
     {
-      if (!file.eof()) error = true;
-      break;
+      if (++i == argc)
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+      else
+      {
+        int interval = atoi(argv[i]);
+        if ((interval < 0) || (interval > 60000))
+        {
+          cout << usage << endl;
+          exit(1);
+        }
+        osdInterval = interval;
+      }
     }
-    if (!(file >> literal))
+    else if (strcmp(argv[i], "-n") == 0)
     {
-      error = true;
-      break;
+      if (++i == argc)
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+      else if (strcmp(argv[i], "jsonrpc") == 0)
+        osdTransport = OSD_JSONRPC;
+      else if (strcmp(argv[i], "eventserver") == 0)
+        osdTransport = OSD_EVENTSERVER;
+      else
+      {
+        cout << usage << endl;
+        exit(1);
+      }
     }
-    if (literal != assignLiteral)
+    else if (strcmp(argv[i], "-i") == 0)
     {
-      error = true;
-      break;
+      if (++i == argc)
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+      // mapped once, the file is never read again
+      else if (!CEventServerSession::LoadIcon(argv[i], osdIcon))
+        exit(1);
+    }
+    else if (strcmp(argv[i], "--compile-config") == 0)
+      compileConfig = true;
+    else if (strcmp(argv[i], "-r") == 0)
+    {
+      if (++i == argc)
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+      else if (strcmp(argv[i], "native") == 0)
+        navigationRepeat = REPEAT_HOLD;
+      else if (strcmp(argv[i], "soft") == 0)
+        navigationRepeat = REPEAT_TIMER;
+      else if (strcmp(argv[i], "off") == 0)
+        navigationRepeat = REPEAT_NONE;
+      else
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "-t") == 0)
+    {
+      xbmc_endpoint endpoint;
+      if (++i == argc || !parseEndpoint(argv[i], endpoint))
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+      else
+        defaultTargets.push_back(endpoint);
+    }
+    else if (strcmp(argv[i], "-a") == 0)
+    {
+      adapter_binding binding;
+      if (++i == argc || !parseBinding(argv[i], binding))
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+      else
+        bindings.push_back(binding);
+    }
+    else if (strcmp(argv[i], "-m") == 0)
+    {
+      if (++i == argc)
+      {
+        cout << usage << endl;
+        exit(1);
+      }
+      else
+        metricsPath = argv[i];
+    }
+    else
+    {
+      cout << usage << endl;
+      exit((strcmp(argv[i], "-h") == 0) ? 0 : 1);
     }
-    getline(file, json);
-    keyMap[keycode] = json;
-    i++;
-  }
-
-  if (error)
-  {
-    cout << "could not parse config file line #" << i << endl;
-    exit(1);
   }
 }
 
@@ -533,19 +530,33 @@ int main (int argc, char* argv[])
   daemonize = false;
   logEvents = false;
   configFilePath = "/etc/cecanyway.conf";
+  compileConfig = false;
   parseOptions(argc, argv);
 
-  system("pactl set-source-output-volume 0 -- 100%");
-  system("pactl set-sink-input-volume 0 -- 100%");
-
-  populateKeyMapDefault();
-  populateEventMapDefault();
-
-  ifstream configFileStream(configFilePath.c_str());
-  if (configFileStream) {
+  set<string> paths = configPaths();
+  if (compileConfig)
+  {
+    bool ok = true;
+    for (set<string>::const_iterator it = paths.begin(); it != paths.end(); ++it)
+    {
+      CKeyTable *table = loadKeyTable(*it);
+      ok = table && compileKeyTable(*table, *it, *it + CACHE_SUFFIX, navigationRepeat) && ok;
+      delete table;
+    }
+    return ok ? 0 : 1;
+  }
 
-    populateKeyMapFromFile(configFileStream);
-    configFileStream.close();
+  // the compiled cache as long as it matches the config, the config otherwise;
+  // every adapter using a config file gets a copy of its table
+  map<string, CKeyTable *> tables;
+  for (set<string>::const_iterator it = paths.begin(); it != paths.end(); ++it)
+  {
+    CKeyTable *table = loadKeyTableCache(*it, *it + CACHE_SUFFIX, navigationRepeat);
+    if (!table)
+      table = loadKeyTable(*it);
+    if (!table)
+      exit(1);
+    tables[*it] = table;
   }
 
   if (daemonize)
@@ -573,26 +584,34 @@ int main (int argc, char* argv[])
     setsid();
   }
 
-  if (signal(SIGINT, sighandler) == SIG_ERR)
+  // blocked before any thread is started, so they all leave them to the signalfd
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGUSR1);
+  if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0
+      || (signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0
+      || !reactor.Open() || !reactor.Add(signalFd, &onSignal))
   {
     cout << "can't register sighandler" << endl;
     return -1;
   }
 
-  configuration.Clear();
-  callbacks.Clear();
-  snprintf(configuration.strDeviceName, 13, "cecanyway");
-  configuration.clientVersion = CEC_CONFIG_VERSION;
-  configuration.bActivateSource = 0;
-  callbacks.CBCecKeyPress = &CecKeyPressCB;
-  configuration.callbacks = &callbacks;
+  // metrics are nice to have, the daemon runs fine without them
+  if (metrics.Open(metricsPath, &writeMetrics))
+    reactor.Add(metrics.Fd(), &onMetrics);
 
-  configuration.deviceTypes.Add(CEC_DEVICE_TYPE_PLAYBACK_DEVICE);
-  configuration.deviceTypes.Add(CEC_DEVICE_TYPE_AUDIO_SYSTEM);
+  // pulse is set up while libcec looks for the adapters
+  thread audioSetup(&setupPulse);
 
-  ICECAdapter *parser = LibCecInitialise(&configuration);
+  // this instance only looks for adapters, each one found gets its own
+  ICECCallbacks callbacks;
+  libcec_configuration configuration;
+  ICECAdapter *parser = initialiseLibCec(configuration, callbacks, NULL);
   if (!parser)
   {
+    audioSetup.join();
 #ifdef __WINDOWS__
     cout << "Cannot load libcec.dll" << endl;
 #else
@@ -604,35 +623,112 @@ int main (int argc, char* argv[])
   // init video on targets that need this
   parser->InitVideoStandalone();
 
-  cout << "autodetect serial port: ";
+  cout << "autodetect serial ports: ";
   cec_adapter devices[10];
-  uint8_t iDevicesFound = parser->FindAdapters(devices, 10, NULL);
+  int8_t iDevicesFound = parser->FindAdapters(devices, 10, NULL);
+  audioSetup.join();
   if (iDevicesFound <= 0)
   {
     cout << "FAILED" << endl;
     UnloadLibCec(parser);
     return 1;
   }
-  else
+  for (int8_t i = 0; i < iDevicesFound; i++)
+    cout << devices[i].comm << " ";
+  cout << endl;
+
+  for (unsigned int i = 0; i < bindings.size(); i++)
   {
-    port = devices[0].comm;
-    cout << port << endl;
+    int8_t found = 0;
+    while (found < iDevicesFound && bindings[i].comm != devices[found].comm)
+      found++;
+    if (found == iDevicesFound)
+      cout << "adapter " << bindings[i].comm << " not found" << endl;
   }
 
-  cout << "opening a connection to the CEC adapter..." << endl;
+  if (!runner.Start())
+  {
+    UnloadLibCec(parser);
+    return 1;
+  }
 
-  if (!parser->Open(port.c_str()))
+  for (int8_t i = 0; i < iDevicesFound; i++)
   {
-    cout << "unable to open the device on port " << port << endl;
+    cec_instance *instance = openAdapter(devices[i].comm, tables);
+    if (!instance)
+      continue;
+    instances.push_back(instance);
+    keyContexts.push_back(instance->context);
+
+    for (unsigned int j = 0; j < instance->context->targets.size(); j++)
+    {
+      target_watch *watch = new target_watch;
+      watch->target = instance->context->targets[j];
+      watch->eventServer.fd = watch->rpcClient.fd = -1;
+      watch->eventServer.generation = watch->rpcClient.generation = 0;
+      watch->eventServer.owner = watch->rpcClient.owner = watch;
+      targetWatches.push_back(watch);
+    }
+  }
+
+  for (map<string, CKeyTable *>::iterator it = tables.begin(); it != tables.end(); ++it)
+    delete it->second;
+  tables.clear();
+
+  if (instances.empty())
+  {
+    runner.Stop();
     UnloadLibCec(parser);
     return 1;
   }
+  destroyLibCec(parser, false);
 
-  pause();
+  // mapping changes are picked up without a restart, one watcher per file
+  set<string> watched;
+  for (unsigned int i = 0; i < instances.size(); i++)
+  {
+    const string &path = instances[i]->context->configPath;
+    if (!watched.insert(path).second)
+      continue;
 
-  parser->Close();
+    CConfigWatcher *watcher = new CConfigWatcher;
+    if (watcher->Open(path, &reloadKeyTable))
+    {
+      reactor.Add(watcher->Fd(), &onConfigChange, watcher);
+      reactor.Add(watcher->TimerFd(), &onConfigSettled, watcher);
+    }
+    configWatchers.push_back(watcher);
+  }
 
-  UnloadLibCec(parser);
+  // keepalives and reconnects
+  if (reactor.AddTimer(1000, &onTick) < 0)
+    cout << "cannot create keepalive timer" << endl;
+  for (unsigned int i = 0; i < targetWatches.size(); i++)
+    syncTransports(*targetWatches[i]);
+
+  reactor.Run();
+
+  for (unsigned int i = 0; i < instances.size(); i++)
+    instances[i]->parser->Close();
+  for (unsigned int i = 0; i < instances.size(); i++)
+    instances[i]->context->Stop();
+  runner.Stop();
+  pulse.disconnect();
+  metrics.Close();
+  for (unsigned int i = 0; i < configWatchers.size(); i++)
+    delete configWatchers[i];
+  reactor.Close();
+  close(signalFd);
+
+  keyContexts.clear();
+  for (unsigned int i = 0; i < targetWatches.size(); i++)
+    delete targetWatches[i];
+  for (unsigned int i = 0; i < instances.size(); i++)
+  {
+    destroyLibCec(instances[i]->parser, i + 1 == instances.size());
+    delete instances[i]->context;
+    delete instances[i];
+  }
 
   return 0;
 }
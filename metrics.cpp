@@ -0,0 +1,247 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "metrics.h"
+#include "monotonic.h"
+#include <errno.h>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+CMetricsServer::CMetricsServer()
+  : m_Socket(-1), m_Epoll(-1), m_Timer(-1), m_Snapshot(NULL)
+{
+}
+
+CMetricsServer::~CMetricsServer()
+{
+  Close();
+}
+
+bool CMetricsServer::Open(const string &Path, Snapshot snapshot)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (Path.empty() || Path.length() >= sizeof(addr.sun_path))
+  {
+    cout << "invalid metrics socket path: " << Path << endl;
+    return false;
+  }
+  strcpy(addr.sun_path, Path.c_str());
+
+  int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sockfd < 0)
+  {
+    cout << "error creating metrics socket" << endl;
+    return false;
+  }
+
+  // a previous instance may have left its socket behind
+  unlink(Path.c_str());
+  if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sockfd, 4) < 0)
+  {
+    cout << "error listening on metrics socket " << Path << ": " << strerror(errno) << endl;
+    close(sockfd);
+    return false;
+  }
+
+  m_Path = Path;
+  m_Socket = sockfd;
+  m_Snapshot = snapshot;
+
+  m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+  m_Timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = m_Socket;
+  bool added = m_Epoll >= 0 && m_Timer >= 0 && epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Socket, &event) == 0;
+  event.data.fd = m_Timer;
+  if (!added || epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Timer, &event) < 0)
+  {
+    cout << "error setting up the metrics socket: " << strerror(errno) << endl;
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void CMetricsServer::Close()
+{
+  while (!m_Clients.empty())
+    Drop(m_Clients.size() - 1);
+  if (m_Timer >= 0)
+    close(m_Timer);
+  if (m_Epoll >= 0)
+    close(m_Epoll);
+  m_Timer = -1;
+  m_Epoll = -1;
+
+  if (m_Socket < 0)
+    return;
+  close(m_Socket);
+  unlink(m_Path.c_str());
+  m_Socket = -1;
+}
+
+void CMetricsServer::Serve()
+{
+  if (m_Socket < 0)
+    return;
+
+  uint64_t expirations;
+  if (read(m_Timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+    cout << "error reading the metrics timer: " << strerror(errno) << endl;
+
+  Accept();
+
+  // answer whoever sent its request, hung up or waited long enough
+  int64_t now = monotonicMs();
+  for (unsigned int i = 0; i < m_Clients.size();)
+  {
+    char request[512];
+    ssize_t length = recv(m_Clients[i].fd, request, sizeof(request), MSG_DONTWAIT);
+    if (length < 0 && (errno == EAGAIN || errno == EINTR) && now < m_Clients[i].deadline)
+    {
+      i++;
+      continue;
+    }
+    Respond(m_Clients[i].fd, length >= 4 && memcmp(request, "GET ", 4) == 0);
+    Drop(i);
+  }
+  ArmTimer();
+}
+
+void CMetricsServer::Accept()
+{
+  for (;;)
+  {
+    int client = accept4(m_Socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client < 0)
+      return;
+
+    // give an HTTP client a moment to send its request line
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = client;
+    if (m_Clients.size() >= MAX_CLIENTS || epoll_ctl(m_Epoll, EPOLL_CTL_ADD, client, &event) < 0)
+    {
+      Respond(client, false);
+      close(client);
+      continue;
+    }
+
+    waiting_client waiting = { client, monotonicMs() + REQUEST_TIMEOUT_MS };
+    m_Clients.push_back(waiting);
+  }
+}
+
+void CMetricsServer::Drop(unsigned int Index)
+{
+  // closing the descriptor also takes it out of the epoll set
+  close(m_Clients[Index].fd);
+  m_Clients.erase(m_Clients.begin() + Index);
+}
+
+void CMetricsServer::ArmTimer()
+{
+  // one-shot at the earliest deadline, disarmed when nobody waits
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (!m_Clients.empty())
+  {
+    int64_t deadline = m_Clients[0].deadline;
+    for (unsigned int i = 1; i < m_Clients.size(); i++)
+      if (m_Clients[i].deadline < deadline)
+        deadline = m_Clients[i].deadline;
+    int64_t wait = deadline - monotonicMs();
+    if (wait < 1)
+      wait = 1;
+    spec.it_value.tv_sec = wait / 1000;
+    spec.it_value.tv_nsec = (wait % 1000) * 1000000L;
+  }
+  timerfd_settime(m_Timer, 0, &spec, NULL);
+}
+
+void CMetricsServer::Respond(int Client, bool Http)
+{
+  stringstream body;
+  m_Snapshot(body);
+  string text = body.str();
+
+  string response;
+  if (Http)
+  {
+    stringstream header;
+    header << "HTTP/1.0 200 OK\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << text.length() << "\r\n\r\n";
+    response = header.str();
+  }
+  response += text;
+
+  // the socket buffer takes a snapshot easily, a client that
+  // does not read is not worth stalling the main thread for
+  const char *data = response.c_str();
+  size_t left = response.length();
+  while (left > 0)
+  {
+    ssize_t n = send(Client, data, left, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      data += n;
+      left -= n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      cout << "metrics client does not read, dropped" << endl;
+    return;
+  }
+}
+
+void metricHeader(ostream &out, const char *name, const char *type, const char *help)
+{
+  out << "# HELP " << name << " " << help << "\n";
+  out << "# TYPE " << name << " " << type << "\n";
+}
+
+void metricSummary(ostream &out, const char *name, const string &labels, const CLatencyHistogram &h)
+{
+  static const double quantiles[] = { 0.5, 0.9, 0.99 };
+  string sep = labels.empty() ? "" : ",";
+
+  for (unsigned int i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+    out << name << "{" << labels << sep << "quantile=\"" << quantiles[i] << "\"} "
+        << h.Percentile(quantiles[i]) / 1e9 << "\n";
+  out << name << "_sum{" << labels << "} " << h.Sum() / 1e9 << "\n";
+  out << name << "_count{" << labels << "} " << h.Count() << "\n";
+}
@@ -0,0 +1,83 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "latency.h"
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Serves a snapshot of the daemon's counters in the Prometheus text format
+ * on a unix domain socket.
+ *
+ * A client that sends an HTTP GET gets an HTTP/1.0 response, anything else
+ * (e.g. socat or nc that just connect) gets the bare text once it has been
+ * quiet for REQUEST_TIMEOUT_MS. Nothing blocks: the listening socket, the
+ * clients waiting for their request and a timer share an epoll set, the
+ * owner polls Fd() and calls Serve() when it becomes readable. A client
+ * that cannot take the whole response at once is dropped.
+ */
+class CMetricsServer
+{
+public:
+  typedef void (*Snapshot)(std::ostream &out);
+
+  CMetricsServer();
+  ~CMetricsServer();
+
+  bool Open(const std::string &Path, Snapshot snapshot);
+  void Close();
+
+  int Fd() const { return m_Epoll; }
+  void Serve();
+
+  static const int REQUEST_TIMEOUT_MS = 100;
+  static const unsigned int MAX_CLIENTS = 8;
+
+private:
+  struct waiting_client
+  {
+    int      fd;
+    int64_t  deadline;   // monotonic ms, answered as bare text after it
+  };
+
+  void Accept();
+  void Respond(int Client, bool Http);
+  void Drop(unsigned int Index);
+  void ArmTimer();
+
+  std::string  m_Path;
+  int          m_Socket;
+  int          m_Epoll;
+  int          m_Timer;
+  Snapshot     m_Snapshot;
+  std::vector<waiting_client>  m_Clients;
+};
+
+// helpers for writing the text exposition format
+void metricHeader(std::ostream &out, const char *name, const char *type, const char *help);
+void metricSummary(std::ostream &out, const char *name, const std::string &labels, const CLatencyHistogram &h);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "notifier.h"
+#include "monotonic.h"
+#include <stdio.h>
+
+CNotifier::CNotifier(Show show, void *Context, unsigned int IntervalMs)
+  : m_Show(show), m_Context(Context), m_Interval(IntervalMs), m_Waiting(false), m_LastShown(0), m_Superseded(0)
+{
+}
+
+void CNotifier::Post(const char *Title, const char *Message, const char *Image, int DisplayTime)
+{
+  if (m_Waiting)
+    m_Superseded.fetch_add(1, std::memory_order_relaxed);
+
+  snprintf(m_Pending.title, sizeof(m_Pending.title), "%s", Title);
+  snprintf(m_Pending.message, sizeof(m_Pending.message), "%s", Message);
+  snprintf(m_Pending.image, sizeof(m_Pending.image), "%s", Image);
+  m_Pending.displaytime = DisplayTime;
+
+  int64_t now = monotonicMs();
+  if (m_LastShown != 0 && now < m_LastShown + m_Interval)
+  {
+    m_Waiting = true;
+    return;
+  }
+
+  m_Waiting = false;
+  m_LastShown = now;
+  m_Show(m_Context, m_Pending);
+}
+
+int CNotifier::Flush()
+{
+  if (!m_Waiting)
+    return -1;
+
+  int64_t now = monotonicMs();
+  int64_t due = m_LastShown + m_Interval;
+  if (now < due)
+    return (int)(due - now);
+
+  m_Waiting = false;
+  m_LastShown = now;
+  m_Show(m_Context, m_Pending);
+  return -1;
+}
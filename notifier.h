@@ -0,0 +1,75 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __NOTIFIER_H__
+#define __NOTIFIER_H__
+
+#include <stdint.h>
+#include <atomic>
+
+struct notification
+{
+  char title[64];
+  char message[64];
+  char image[64];
+  int  displaytime;    // ms, 0 for xbmc's default
+};
+
+/*
+ * Debounces OSD notifications through a single latest-value-wins slot.
+ *
+ * Post() shows a notification at once if the interval has passed since
+ * the last one was shown. Otherwise it replaces whatever is waiting in
+ * the slot, and Flush() shows that once the interval is over.
+ * A burst of volume changes thus costs xbmc one toast per interval, and
+ * the last one shown is the final state. Texts that do not fit are cut
+ * off. Not thread-safe, Post() and Flush() must be called from the same
+ * thread.
+ */
+class CNotifier
+{
+public:
+  typedef void (*Show)(void *Context, const notification &n);
+
+  // an interval of 0 shows every notification
+  CNotifier(Show show, void *Context, unsigned int IntervalMs);
+
+  void Post(const char *Title, const char *Message, const char *Image = "", int DisplayTime = 0);
+
+  // shows the waiting notification once the interval is over, returns the
+  // ms until Flush() needs to be called again or -1 if nothing is waiting
+  int Flush();
+
+  // notifications replaced by a newer one before they were shown
+  unsigned int Superseded() const { return m_Superseded.load(std::memory_order_relaxed); }
+
+private:
+  Show                       m_Show;
+  void                      *m_Context;
+  unsigned int               m_Interval;
+  notification               m_Pending;
+  bool                       m_Waiting;
+  int64_t                    m_LastShown;   // monotonicMs(), 0 before the first
+  std::atomic<unsigned int>  m_Superseded;
+};
+
+#endif
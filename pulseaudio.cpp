@@ -0,0 +1,307 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "pulseaudio.h"
+#include <cassert>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// holds the mainloop lock for a scope, so a throw cannot leak it
+class mainloop_lock {
+private:
+    pa_threaded_mainloop *m;
+public:
+    mainloop_lock(pa_threaded_mainloop *m) : m(m) {
+        pa_threaded_mainloop_lock(m);
+    }
+    ~mainloop_lock() {
+        pa_threaded_mainloop_unlock(m);
+    }
+};
+
+}
+
+pulseaudio::pulseaudio() {
+    mainloop = NULL;
+    context = NULL;
+    volume_amount = 0.0;
+    result = -1.0;
+    sink_mute = false;
+    sink_known = false;
+    pa_cvolume_init(&sink_volume);
+    refresh.self = this;
+    refresh.error = NULL;
+}
+
+pulseaudio::~pulseaudio() {
+    disconnect();
+}
+
+bool pulseaudio::volume_relative_adjust(pa_cvolume *cv) {
+    /* Relative volume change is additive in case of a PERCENTAGE */
+    pa_volume_t v = pa_cvolume_avg(cv);
+    bool up = volume_amount >= 0;
+    if (!up)
+           volume_amount = -volume_amount;
+    pa_volume_t adjustment = (volume_amount * PA_VOLUME_NORM);
+    if (adjustment == 0) {
+        result = (float)v / PA_VOLUME_NORM;
+        return false;
+    } else {
+        if (up)
+            v = v+adjustment < PA_VOLUME_MUTED ? PA_VOLUME_MUTED : v + adjustment;
+        else
+            v = (int32_t)v-(int32_t)adjustment < PA_VOLUME_MUTED ? PA_VOLUME_MUTED : v - adjustment;
+        if (v > MAX_VOLUME)
+    up ? v = MAX_VOLUME : v = PA_VOLUME_MUTED;
+        pa_cvolume_set(cv, 1, v);
+        result = (float) v / PA_VOLUME_NORM;
+        return true;
+    }
+}
+
+void pulseaudio::context_state_callback(pa_context *c, void *userdata) {
+    pulseaudio *self = (pulseaudio *)userdata;
+    pa_threaded_mainloop_signal(self->mainloop, 0);
+}
+
+void pulseaudio::subscribe_callback(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    pulseaudio *self = (pulseaudio *)userdata;
+    if ((t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) != PA_SUBSCRIPTION_EVENT_SINK || idx != SINK_INDEX)
+        return;
+
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+        self->sink_known = false;
+        return;
+    }
+    // someone else (or we) changed the sink, refresh the cache in the background
+    pa_operation *o = pa_context_get_sink_info_by_index(c, SINK_INDEX, sink_info_callback, &self->refresh);
+    if (o)
+        pa_operation_unref(o);
+}
+
+void pulseaudio::sink_info_callback(pa_context *c, const pa_sink_info *i, int is_last, void *userdata) {
+    op_state *op = (op_state *)userdata;
+    pulseaudio *self = op->self;
+    if (is_last < 0) {
+        if (op->error) {
+            *op->error += "PulseAudio error Failed to get sink information: ";
+            *op->error += pa_strerror(pa_context_errno(c));
+        }
+        self->sink_known = false;
+    } else if (!is_last) {
+        assert(i);
+        self->sink_volume = i->volume;
+        self->sink_mute = i->mute;
+        self->sink_known = true;
+    }
+    pa_threaded_mainloop_signal(self->mainloop, 0);
+}
+
+void pulseaudio::success_callback(pa_context *c, int success, void *userdata) {
+    op_state *op = (op_state *)userdata;
+    if (!success) {
+        *op->error += "PulseAudio error: ";
+        *op->error += pa_strerror(pa_context_errno(c));
+    }
+    pa_threaded_mainloop_signal(op->self->mainloop, 0);
+}
+
+void pulseaudio::connect_locked() {
+    if (context) {
+        pa_context_state_t state = pa_context_get_state(context);
+        if (state == PA_CONTEXT_READY)
+            return;
+        // pulse went away (or never came up), start over with a new context
+        disconnect_locked();
+    }
+
+    if (!(context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "cecanyway"))) {
+        throw runtime_error("Cannot create pulse context");
+    }
+    pa_context_set_state_callback(context, context_state_callback, this);
+    pa_context_set_subscribe_callback(context, subscribe_callback, this);
+    if (pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+        throw runtime_error("pa_context_connect() failed");
+    }
+
+    for (;;) {
+        pa_context_state_t state = pa_context_get_state(context);
+        if (state == PA_CONTEXT_READY)
+            break;
+        if (!PA_CONTEXT_IS_GOOD(state)) {
+            string msg = "PulseAudio error Connection failure: ";
+            msg += pa_strerror(pa_context_errno(context));
+            throw runtime_error(msg);
+        }
+        pa_threaded_mainloop_wait(mainloop);
+    }
+
+    pa_operation *o = pa_context_subscribe(context, PA_SUBSCRIPTION_MASK_SINK, NULL, NULL);
+    if (o)
+        pa_operation_unref(o);
+    string error;
+    fetch_sink_locked(error);
+}
+
+void pulseaudio::disconnect_locked() {
+    sink_known = false;
+    if (!context)
+        return;
+    pa_context_set_state_callback(context, NULL, NULL);
+    pa_context_set_subscribe_callback(context, NULL, NULL);
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    context = NULL;
+}
+
+void pulseaudio::wait_locked(pa_operation *o, string &error) {
+    if (!o) {
+        error += "PulseAudio error: ";
+        error += pa_strerror(pa_context_errno(context));
+        return;
+    }
+    while (pa_operation_get_state(o) == PA_OPERATION_RUNNING) {
+        if (!PA_CONTEXT_IS_GOOD(pa_context_get_state(context))) {
+            error += "PulseAudio error Connection failure: ";
+            error += pa_strerror(pa_context_errno(context));
+            pa_operation_cancel(o);
+            break;
+        }
+        pa_threaded_mainloop_wait(mainloop);
+    }
+    pa_operation_unref(o);
+}
+
+void pulseaudio::fetch_sink_locked(string &error) {
+    op_state op = { this, &error };
+    wait_locked(pa_context_get_sink_info_by_index(context, SINK_INDEX, sink_info_callback, &op), error);
+}
+
+void pulseaudio::connect() {
+    if (!mainloop) {
+        if (!(mainloop = pa_threaded_mainloop_new())) {
+            throw runtime_error("Cannot create pulse mainloop");
+        }
+        if (pa_threaded_mainloop_start(mainloop) < 0) {
+            pa_threaded_mainloop_free(mainloop);
+            mainloop = NULL;
+            throw runtime_error("Cannot start pulse mainloop");
+        }
+    }
+    mainloop_lock lock(mainloop);
+    connect_locked();
+}
+
+void pulseaudio::disconnect() {
+    if (!mainloop)
+        return;
+    {
+        mainloop_lock lock(mainloop);
+        disconnect_locked();
+    }
+    pa_threaded_mainloop_stop(mainloop);
+    pa_threaded_mainloop_free(mainloop);
+    mainloop = NULL;
+}
+
+void pulseaudio::reset_stream_volumes() {
+    connect();
+    mainloop_lock lock(mainloop);
+
+    // a single channel at 100%, pulse scales all of the stream's channels to it
+    pa_cvolume cv;
+    pa_cvolume_set(&cv, 1, PA_VOLUME_NORM);
+
+    // both requests go out before waiting for either
+    string error;
+    op_state op = { this, &error };
+    pa_operation *input = pa_context_set_sink_input_volume(context, SINK_INPUT_INDEX, &cv, success_callback, &op);
+    pa_operation *output = pa_context_set_source_output_volume(context, SOURCE_OUTPUT_INDEX, &cv, success_callback, &op);
+    wait_locked(input, error);
+    wait_locked(output, error);
+
+    if (!error.empty()) {
+        throw runtime_error(error);
+    }
+}
+
+float pulseaudio::modify_volume(float percent) {
+    connect();
+    mainloop_lock lock(mainloop);
+
+    string error;
+    op_state op = { this, &error };
+    if (!sink_known)
+        fetch_sink_locked(error);
+    if (!sink_known) {
+        throw runtime_error(error.empty() ? "PulseAudio error: sink unknown" : error);
+    }
+
+    pa_cvolume cv = sink_volume;
+    volume_amount = percent;
+    bool changed = volume_relative_adjust(&cv);
+    volume_amount = 0.0;
+    if (changed) {
+        sink_volume = cv;
+        wait_locked(pa_context_set_sink_volume_by_index(context, SINK_INDEX, &cv, success_callback, &op), error);
+    }
+
+    if (!error.empty()) {
+        sink_known = false;
+        throw runtime_error(error);
+    }
+    return result;
+}
+
+bool pulseaudio::togglemute() {
+    connect();
+    mainloop_lock lock(mainloop);
+
+    string error;
+    op_state op = { this, &error };
+    if (!sink_known)
+        fetch_sink_locked(error);
+    if (!sink_known) {
+        throw runtime_error(error.empty() ? "PulseAudio error: sink unknown" : error);
+    }
+
+    sink_mute = !sink_mute;
+    wait_locked(pa_context_set_sink_mute_by_index(context, SINK_INDEX, sink_mute, success_callback, &op), error);
+
+    if (!error.empty()) {
+        sink_known = false;
+        throw runtime_error(error);
+    }
+    return sink_mute;
+}
+
+float pulseaudio::volume() {
+    if (!mainloop)
+        return -1.0;
+    mainloop_lock lock(mainloop);
+    if (!sink_known)
+        return -1.0;
+    return (float)pa_cvolume_avg(&sink_volume) / PA_VOLUME_NORM;
+}
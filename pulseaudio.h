@@ -0,0 +1,87 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __PULSEAUDIO_H__
+#define __PULSEAUDIO_H__
+
+#include <pulse/pulseaudio.h>
+#include <string>
+
+/*
+ * Volume and mute control of the default sink.
+ *
+ * One pa_threaded_mainloop and context are kept for the lifetime of the
+ * daemon. The sink's volume and mute state are cached and kept current by
+ * a sink subscription, so a volume key costs a single set-volume round
+ * trip. If pulse goes away the context is rebuilt on the next operation.
+ * Errors are reported as std::runtime_error.
+ */
+class pulseaudio {
+private:
+    pa_threaded_mainloop *mainloop;
+    pa_context *context;
+    static const int SINK_INDEX = 1;
+    static const int SINK_INPUT_INDEX = 0;
+    static const int SOURCE_OUTPUT_INDEX = 0;
+    static const pa_volume_t MAX_VOLUME = PA_VOLUME_NORM * 2;
+    float volume_amount;
+    float result;
+
+    // userdata of an operation, its errors go to the call waiting for it
+    // so concurrent callers never see each other's
+    struct op_state {
+        pulseaudio *self;
+        std::string *error;   // NULL for the background sink refresh
+    };
+    op_state refresh;
+
+    pa_cvolume sink_volume;
+    bool sink_mute;
+    bool sink_known;
+
+    bool volume_relative_adjust(pa_cvolume *cv);
+
+    static void context_state_callback(pa_context *c, void *userdata);
+    static void subscribe_callback(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata);
+    static void sink_info_callback(pa_context *c, const pa_sink_info *i, int is_last, void *userdata);
+    static void success_callback(pa_context *c, int success, void *userdata);
+
+    void connect_locked();
+    void disconnect_locked();
+    void wait_locked(pa_operation *o, std::string &error);
+    void fetch_sink_locked(std::string &error);
+
+public:
+    pulseaudio();
+    ~pulseaudio();
+
+    void connect();
+    void disconnect();
+
+    // sets the first sink input and source output back to 100%
+    void reset_stream_volumes();
+
+    float modify_volume(float percent);
+    bool togglemute();
+    float volume();
+};
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "reactor.h"
+#include <errno.h>
+#include <iostream>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+CReactor::CReactor()
+  : m_Epoll(-1), m_Stop(false)
+{
+}
+
+CReactor::~CReactor()
+{
+  Close();
+}
+
+bool CReactor::Open()
+{
+  if (m_Epoll >= 0)
+    return true;
+
+  m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (m_Epoll < 0)
+  {
+    cout << "cannot create epoll instance" << endl;
+    return false;
+  }
+  return true;
+}
+
+void CReactor::Close()
+{
+  if (m_Epoll < 0)
+    return;
+
+  for (unsigned int fd = 0; fd < m_Timers.size(); fd++)
+    if (m_Timers[fd])
+      close(fd);
+  m_Handlers.clear();
+  m_Contexts.clear();
+  m_Timers.clear();
+  close(m_Epoll);
+  m_Epoll = -1;
+}
+
+bool CReactor::Add(int Fd, Handler handler, void *Context, uint32_t Events)
+{
+  if (Fd < 0)
+    return false;
+
+  struct epoll_event ev;
+  ev.events = Events;
+  ev.data.fd = Fd;
+  if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, Fd, &ev) < 0)
+    return false;
+
+  if ((unsigned int)Fd >= m_Handlers.size())
+  {
+    m_Handlers.resize(Fd + 1, NULL);
+    m_Contexts.resize(Fd + 1, NULL);
+    m_Timers.resize(Fd + 1, false);
+  }
+  m_Handlers[Fd] = handler;
+  m_Contexts[Fd] = Context;
+  m_Timers[Fd] = false;
+  return true;
+}
+
+void CReactor::Remove(int Fd)
+{
+  if (Fd < 0 || (unsigned int)Fd >= m_Handlers.size() || !m_Handlers[Fd])
+    return;
+
+  // fails harmlessly if the descriptor has been closed already
+  epoll_ctl(m_Epoll, EPOLL_CTL_DEL, Fd, NULL);
+  m_Handlers[Fd] = NULL;
+  if (m_Timers[Fd])
+    close(Fd);
+  m_Timers[Fd] = false;
+}
+
+void *CReactor::Context(int Fd) const
+{
+  if (Fd < 0 || (unsigned int)Fd >= m_Handlers.size() || !m_Handlers[Fd])
+    return NULL;
+  return m_Contexts[Fd];
+}
+
+int CReactor::AddTimer(unsigned int IntervalMs, Handler handler, void *Context)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = IntervalMs / 1000;
+  spec.it_interval.tv_nsec = (IntervalMs % 1000) * 1000000L;
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(fd, 0, &spec, NULL) < 0 || !Add(fd, handler, Context))
+  {
+    close(fd);
+    return -1;
+  }
+  m_Timers[fd] = true;
+  return fd;
+}
+
+void CReactor::Run()
+{
+  struct epoll_event events[MAX_EVENTS];
+  m_Stop = false;
+  while (!m_Stop)
+  {
+    int ready = epoll_wait(m_Epoll, events, MAX_EVENTS, -1);
+    if (ready < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      cout << "epoll_wait failed" << endl;
+      return;
+    }
+
+    for (int i = 0; i < ready; i++)
+    {
+      int fd = events[i].data.fd;
+      // an earlier handler may have removed it
+      if ((unsigned int)fd >= m_Handlers.size() || !m_Handlers[fd])
+        continue;
+
+      if (m_Timers[fd])
+      {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+          continue;
+      }
+      m_Handlers[fd](m_Contexts[fd], events[i].events);
+    }
+  }
+}
@@ -0,0 +1,72 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <vector>
+
+/*
+ * An epoll loop for the main thread.
+ *
+ * Handlers are registered per file descriptor and called with their context
+ * and the epoll events when it becomes ready. Timers are timerfds owned by the reactor,
+ * their expirations are read before the handler runs. Handlers may add and
+ * remove descriptors and call Stop(), which makes Run() return once the
+ * current batch of events has been handled. Not thread-safe.
+ */
+class CReactor
+{
+public:
+  typedef void (*Handler)(void *Context, uint32_t events);
+
+  CReactor();
+  ~CReactor();
+
+  bool Open();
+  void Close();
+
+  bool Add(int Fd, Handler handler, void *Context = NULL, uint32_t Events = EPOLLIN);
+  void Remove(int Fd);
+
+  // what Fd was registered with, NULL if it is not
+  void *Context(int Fd) const;
+
+  // a periodic timer, returns its timerfd or -1
+  int AddTimer(unsigned int IntervalMs, Handler handler, void *Context = NULL);
+
+  void Run();
+  void Stop() { m_Stop = true; }
+
+  static const int MAX_EVENTS = 16;
+
+private:
+  int                   m_Epoll;
+  bool                  m_Stop;
+  std::vector<Handler>  m_Handlers;   // indexed by fd
+  std::vector<void *>   m_Contexts;   // indexed by fd
+  std::vector<bool>     m_Timers;     // indexed by fd
+};
+
+#endif
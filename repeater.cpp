@@ -0,0 +1,75 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "repeater.h"
+#include "monotonic.h"
+
+CKeyRepeater::CKeyRepeater(Callback repeat, Callback release, void *Context)
+  : m_Repeat(repeat), m_Release(release), m_Context(Context), m_Keycode(-1), m_Timed(false),
+    m_Interval(INTERVAL_MS), m_NextRepeat(0), m_HoldEnd(0)
+{
+}
+
+void CKeyRepeater::Press(int Keycode, bool Timed)
+{
+  int64_t now = monotonicMs();
+  m_Keycode = Keycode;
+  m_Timed = Timed;
+  m_Interval = INTERVAL_MS;
+  m_NextRepeat = now + DELAY_MS;
+  m_HoldEnd = now + HOLD_TIMEOUT_MS;
+}
+
+int CKeyRepeater::Release()
+{
+  int keycode = m_Keycode;
+  m_Keycode = -1;
+  return keycode;
+}
+
+int CKeyRepeater::Tick()
+{
+  if (m_Keycode < 0)
+    return -1;
+
+  int64_t now = monotonicMs();
+  if (now >= m_HoldEnd)
+  {
+    m_Release(m_Context, Release());
+    return -1;
+  }
+
+  if (m_Timed && now >= m_NextRepeat)
+  {
+    m_Repeat(m_Context, m_Keycode);
+    // the callback may have ended the hold
+    if (m_Keycode < 0)
+      return -1;
+
+    m_NextRepeat = now + m_Interval;
+    m_Interval -= m_Interval / 4;
+    if (m_Interval < MIN_INTERVAL_MS)
+      m_Interval = MIN_INTERVAL_MS;
+  }
+
+  int64_t next = m_Timed && m_NextRepeat < m_HoldEnd ? m_NextRepeat : m_HoldEnd;
+  return (int)(next - now);
+}
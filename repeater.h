@@ -0,0 +1,75 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __REPEATER_H__
+#define __REPEATER_H__
+
+#include <stdint.h>
+
+/*
+ * Tracks the key that is held down and repeats it in software.
+ *
+ * libcec reports a key once when it is pressed and again, with a non-zero
+ * duration, when it is released or its own button timeout expires. Between
+ * the two the key counts as held. A timed hold fires the repeat callback
+ * after DELAY_MS and then ever faster, each interval a quarter shorter than
+ * the last down to MIN_INTERVAL_MS, so long lists scroll quickly without
+ * overshooting short ones. An untimed hold only keeps track of the key, for
+ * transports that repeat on their own until told the key is up.
+ *
+ * Should the release never arrive, the hold is ended after HOLD_TIMEOUT_MS.
+ * Not thread-safe, all calls must come from the same thread.
+ */
+class CKeyRepeater
+{
+public:
+  typedef void (*Callback)(void *Context, int keycode);
+
+  CKeyRepeater(Callback repeat, Callback release, void *Context);
+
+  void Press(int Keycode, bool Timed);
+
+  // ends the hold, returns the keycode that was held or -1
+  int Release();
+
+  int Held() const { return m_Keycode; }
+
+  // fires due repeats, returns the ms until Tick() needs to be called
+  // again or -1 if no key is held
+  int Tick();
+
+  static const int DELAY_MS = 400;
+  static const int INTERVAL_MS = 160;
+  static const int MIN_INTERVAL_MS = 30;
+  static const int HOLD_TIMEOUT_MS = 30000;
+
+private:
+  Callback  m_Repeat;
+  Callback  m_Release;
+  void     *m_Context;
+  int       m_Keycode;     // -1 while no key is held
+  bool      m_Timed;
+  int       m_Interval;
+  int64_t   m_NextRepeat;
+  int64_t   m_HoldEnd;
+};
+
+#endif
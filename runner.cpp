@@ -0,0 +1,256 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "runner.h"
+#include "monotonic.h"
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sstream>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+extern char **environ;
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+CActionRunner::CActionRunner()
+  : m_MaxRunning(MAX_RUNNING), m_Timeout(TIMEOUT_MS), m_WakeFd(-1), m_Stop(false), m_Failures(0), m_Timeouts(0)
+{
+}
+
+CActionRunner::~CActionRunner()
+{
+  Stop();
+}
+
+bool CActionRunner::Start(unsigned int MaxRunning, int TimeoutMs)
+{
+  if (m_WakeFd >= 0)
+    return true;
+
+  m_WakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (m_WakeFd < 0)
+  {
+    cout << "cannot create runner eventfd" << endl;
+    return false;
+  }
+
+  m_MaxRunning = MaxRunning;
+  m_Timeout = TimeoutMs;
+  m_Stop = false;
+  m_Thread = thread(&CActionRunner::Supervise, this);
+  return true;
+}
+
+void CActionRunner::Stop()
+{
+  if (m_WakeFd < 0)
+    return;
+
+  m_Stop = true;
+  uint64_t one = 1;
+  write(m_WakeFd, &one, sizeof(one));
+  m_Thread.join();
+
+  close(m_WakeFd);
+  m_WakeFd = -1;
+}
+
+bool CActionRunner::Run(const string &Command)
+{
+  bool queued;
+  {
+    lock_guard<mutex> lock(m_PushLock);
+    queued = m_WakeFd >= 0 && m_Queue.Push(Command);
+  }
+  if (!queued)
+  {
+    m_Failures.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+
+  uint64_t one = 1;
+  write(m_WakeFd, &one, sizeof(one));
+  return true;
+}
+
+void CActionRunner::Spawn(const string &Command)
+{
+  vector<string> args;
+  stringstream ss(Command);
+  string arg;
+  while (ss >> arg)
+    args.push_back(arg);
+  if (args.empty())
+    return;
+
+  vector<char *> argv;
+  for (unsigned int i = 0; i < args.size(); i++)
+    argv.push_back((char *)args[i].c_str());
+  argv.push_back(NULL);
+
+  // its own process group, so a timeout also takes down what it started
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setpgroup(&attr, 0);
+  sigset_t none;
+  sigemptyset(&none);
+  posix_spawnattr_setsigmask(&attr, &none);
+
+  child c;
+  int error = posix_spawnp(&c.pid, argv[0], NULL, &attr, &argv[0], environ);
+  posix_spawnattr_destroy(&attr);
+  if (error)
+  {
+    cerr << "cannot run " << Command << ": " << strerror(error) << endl;
+    m_Failures.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+
+  c.pidfd = syscall(SYS_pidfd_open, c.pid, 0);
+  c.deadline = monotonicMs() + m_Timeout;
+  c.terminated = false;
+  c.command = Command;
+  m_Children.push_back(c);
+}
+
+// true once the child has exited and was collected
+bool CActionRunner::Reap(child &c)
+{
+  int status;
+  pid_t pid = waitpid(c.pid, &status, WNOHANG);
+  if (pid == 0 || (pid < 0 && errno == EINTR))
+    return false;
+
+  if (pid > 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0) && !c.terminated)
+  {
+    cerr << c.command << " failed with status " << status << endl;
+    m_Failures.fetch_add(1, memory_order_relaxed);
+  }
+  if (c.pidfd >= 0)
+    close(c.pidfd);
+  return true;
+}
+
+// signals children that ran out of time, returns the ms until the next deadline
+int CActionRunner::Expire()
+{
+  int64_t now = monotonicMs();
+  int timeout = -1;
+  for (unsigned int i = 0; i < m_Children.size(); i++)
+  {
+    child &c = m_Children[i];
+    if (now >= c.deadline)
+    {
+      if (!c.terminated)
+      {
+        cerr << c.command << " timed out, terminating" << endl;
+        m_Timeouts.fetch_add(1, memory_order_relaxed);
+        kill(-c.pid, SIGTERM);
+        c.terminated = true;
+      }
+      else
+        kill(-c.pid, SIGKILL);
+      c.deadline = now + KILL_GRACE_MS;
+    }
+
+    int left = (int)(c.deadline - now);
+    if (timeout < 0 || left < timeout)
+      timeout = left;
+    if (c.pidfd < 0 && timeout > REAP_INTERVAL_MS)
+      timeout = REAP_INTERVAL_MS;
+  }
+  return timeout;
+}
+
+void CActionRunner::Supervise()
+{
+  vector<struct pollfd> fds;
+  while (!m_Stop || !m_Children.empty())
+  {
+    string command;
+    while (m_Queue.Pop(command))
+    {
+      if (m_Pending.size() < MAX_PENDING)
+        m_Pending.push_back(command);
+      else
+      {
+        cerr << "too many commands waiting, dropped " << command << endl;
+        m_Failures.fetch_add(1, memory_order_relaxed);
+      }
+    }
+    if (m_Stop)
+      m_Pending.clear();
+    while (!m_Pending.empty() && m_Children.size() < m_MaxRunning)
+    {
+      Spawn(m_Pending.front());
+      m_Pending.pop_front();
+    }
+
+    for (unsigned int i = 0; i < m_Children.size(); )
+    {
+      if (Reap(m_Children[i]))
+        m_Children.erase(m_Children.begin() + i);
+      else
+        i++;
+    }
+    if (m_Stop && m_Children.empty())
+      break;
+
+    // on shutdown children get the same treatment as timed out ones
+    if (m_Stop)
+    {
+      for (unsigned int i = 0; i < m_Children.size(); i++)
+        if (!m_Children[i].terminated)
+          m_Children[i].deadline = 0;
+    }
+    int timeout = Expire();
+
+    fds.clear();
+    struct pollfd wake = { m_WakeFd, POLLIN, 0 };
+    fds.push_back(wake);
+    for (unsigned int i = 0; i < m_Children.size(); i++)
+    {
+      struct pollfd pfd = { m_Children[i].pidfd, POLLIN, 0 };
+      if (pfd.fd >= 0)
+        fds.push_back(pfd);
+    }
+
+    if (poll(&fds[0], fds.size(), timeout) < 0 && errno != EINTR)
+      break;
+    if (fds[0].revents & POLLIN)
+    {
+      uint64_t count;
+      read(m_WakeFd, &count, sizeof(count));
+    }
+  }
+}
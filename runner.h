@@ -0,0 +1,96 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __RUNNER_H__
+#define __RUNNER_H__
+
+#include "spscqueue.h"
+#include <sys/types.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Runs external commands for exec actions off the key handling path.
+ *
+ * Run() only queues the command line and wakes the supervisor thread. The
+ * supervisor starts it with posix_spawnp(), without a shell, split at
+ * whitespace, in its own process group. At most MaxRunning commands run at
+ * once, the rest wait their turn. A command still running after its timeout
+ * gets a SIGTERM, and a SIGKILL KILL_GRACE_MS later. Children are reaped
+ * as soon as their pidfd becomes readable; on kernels without pidfds they
+ * are polled with waitpid() instead.
+ */
+class CActionRunner
+{
+public:
+  CActionRunner();
+  ~CActionRunner();
+
+  bool Start(unsigned int MaxRunning = MAX_RUNNING, int TimeoutMs = TIMEOUT_MS);
+  void Stop();
+
+  // may be called from any thread, returns false if the queue is full
+  bool Run(const std::string &Command);
+
+  unsigned int Failures() const { return m_Failures.load(std::memory_order_relaxed); }
+  unsigned int Timeouts() const { return m_Timeouts.load(std::memory_order_relaxed); }
+
+  static const unsigned int QUEUE_SIZE = 16;
+  static const unsigned int MAX_PENDING = 16;
+  static const unsigned int MAX_RUNNING = 2;
+  static const int TIMEOUT_MS = 30000;
+  static const int KILL_GRACE_MS = 2000;
+  static const int REAP_INTERVAL_MS = 100;   // without pidfds
+
+private:
+  struct child
+  {
+    pid_t        pid;
+    int          pidfd;      // -1 if the kernel has no pidfd_open()
+    int64_t      deadline;   // when to send the next signal
+    bool         terminated; // SIGTERM has been sent
+    std::string  command;
+  };
+
+  void Supervise();
+  void Spawn(const std::string &Command);
+  bool Reap(child &c);
+  int Expire();
+
+  CSpscQueue<std::string, QUEUE_SIZE> m_Queue;
+  std::mutex                 m_PushLock;   // every adapter's dispatcher pushes
+  std::deque<std::string>    m_Pending;
+  std::vector<child>         m_Children;
+  unsigned int               m_MaxRunning;
+  int                        m_Timeout;
+  std::thread                m_Thread;
+  int                        m_WakeFd;
+  std::atomic<bool>          m_Stop;
+  std::atomic<unsigned int>  m_Failures;
+  std::atomic<unsigned int>  m_Timeouts;
+};
+
+#endif
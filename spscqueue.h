@@ -0,0 +1,97 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __SPSCQUEUE_H__
+#define __SPSCQUEUE_H__
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#define SPSC_ALIGNMENT 64
+
+/*
+ * Bounded lock-free ring buffer for exactly one producer thread and one
+ * consumer thread. Head and tail live on separate cache lines so the two
+ * sides do not bounce the same line between cores.
+ */
+template <typename T, unsigned int Capacity>
+class CSpscQueue
+{
+  static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+  CSpscQueue() : m_Head(0), m_Tail(0) {}
+
+  // producer side, returns false if the queue is full
+  bool Push(const T &item)
+  {
+    unsigned int tail = m_Tail.load(std::memory_order_relaxed);
+    if (tail - m_Head.load(std::memory_order_acquire) == Capacity)
+      return false;
+    m_Items[tail & (Capacity - 1)] = item;
+    m_Tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side, returns false if the queue is empty
+  bool Pop(T &item)
+  {
+    unsigned int head = m_Head.load(std::memory_order_relaxed);
+    if (head == m_Tail.load(std::memory_order_acquire))
+      return false;
+    item = m_Items[head & (Capacity - 1)];
+    m_Head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // approximate when read from a third thread
+  unsigned int Depth() const
+  {
+    return m_Tail.load(std::memory_order_acquire) - m_Head.load(std::memory_order_acquire);
+  }
+
+private:
+  alignas(SPSC_ALIGNMENT) std::atomic<unsigned int> m_Head;
+  alignas(SPSC_ALIGNMENT) std::atomic<unsigned int> m_Tail;
+  alignas(SPSC_ALIGNMENT) T m_Items[Capacity];
+};
+
+/*
+ * Base for classes that hold a queue and are created with new, which
+ * ignores the queue's alignment before C++17.
+ */
+class CAlignedAlloc
+{
+public:
+  static void *operator new(size_t size)
+  {
+    void *p;
+    if (posix_memalign(&p, SPSC_ALIGNMENT, size) != 0)
+      throw std::bad_alloc();
+    return p;
+  }
+
+  static void operator delete(void *p) { free(p); }
+};
+
+#endif
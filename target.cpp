@@ -0,0 +1,177 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "target.h"
+#include "monotonic.h"
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+static string endpointName(const xbmc_endpoint &Endpoint)
+{
+  stringstream ss;
+  ss << Endpoint.host << ":" << Endpoint.rpcPort;
+  return ss.str();
+}
+
+// the histograms have no constructor, value-initialising them zeroes them
+CXbmcTarget::CXbmcTarget(const xbmc_endpoint &Endpoint)
+  : m_Name(endpointName(Endpoint)),
+    m_EventServer(Endpoint.host.c_str(), Endpoint.eventPort),
+    m_RpcClient(Endpoint.host.c_str(), Endpoint.rpcPort),
+    m_WakeFd(-1), m_Stop(false), m_Posted(0), m_Done(0), m_Dropped(0), m_Latency()
+{
+}
+
+CXbmcTarget::~CXbmcTarget()
+{
+  Stop();
+}
+
+bool CXbmcTarget::Start()
+{
+  if (m_WakeFd >= 0)
+    return true;
+
+  m_WakeFd = eventfd(0, EFD_CLOEXEC);
+  if (m_WakeFd < 0)
+  {
+    cout << "cannot create eventfd for " << m_Name << endl;
+    return false;
+  }
+
+  m_Stop = false;
+  m_Thread = thread(&CXbmcTarget::Run, this);
+  return true;
+}
+
+void CXbmcTarget::Stop()
+{
+  if (m_WakeFd < 0)
+    return;
+
+  m_Stop = true;
+  uint64_t one = 1;
+  write(m_WakeFd, &one, sizeof(one));
+  m_Thread.join();
+
+  close(m_WakeFd);
+  m_WakeFd = -1;
+  m_EventServer.Disconnect();
+  m_RpcClient.Disconnect();
+}
+
+bool CXbmcTarget::Post()
+{
+  m_Request.queued = monotonicNs();
+  if (m_WakeFd < 0 || !m_Queue.Push(m_Request))
+  {
+    m_Dropped.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+  m_Posted.fetch_add(1, memory_order_release);
+
+  uint64_t one = 1;
+  write(m_WakeFd, &one, sizeof(one));
+  return true;
+}
+
+bool CXbmcTarget::Send(const encoded_datagram *Datagrams, unsigned int Count)
+{
+  if (Count > MAX_DATAGRAMS)
+    return false;
+
+  m_Request.type = ACT_EVENTSERVER;
+  m_Request.notify = false;
+  m_Request.count = Count;
+  for (unsigned int i = 0; i < Count; i++)
+    m_Request.datagrams[i] = Datagrams[i];
+  m_Request.json.clear();
+  return Post();
+}
+
+bool CXbmcTarget::Send(const char *Json, size_t Length)
+{
+  m_Request.type = ACT_JSONRPC;
+  m_Request.notify = false;
+  m_Request.count = 0;
+  m_Request.json.assign(Json, Length);
+  return Post();
+}
+
+bool CXbmcTarget::Send(const notification &Note, const event_icon *Icon)
+{
+  m_Request.type = ACT_EVENTSERVER;
+  m_Request.notify = true;
+  m_Request.count = 0;
+  m_Request.note = Note;
+  m_Request.icon = Icon;
+  m_Request.json.clear();
+  return Post();
+}
+
+void CXbmcTarget::Run()
+{
+  // register with the event server before the first key press arrives
+  m_EventServer.Connect();
+  m_RpcClient.Connect();
+
+  request r;
+  int64_t nextTick = monotonicMs() + TICK_INTERVAL_MS;
+  while (!m_Stop)
+  {
+    while (m_Queue.Pop(r))
+    {
+      if (r.notify)
+        m_EventServer.SendNotification(r.note.title, r.note.message, r.icon);
+      else if (r.type == ACT_EVENTSERVER)
+        m_EventServer.Send(r.datagrams, r.count);
+      else
+        m_RpcClient.Send(r.json);
+      m_Latency[r.type].Record(monotonicNs() - r.queued);
+      m_Done.fetch_add(1, memory_order_release);
+    }
+
+    int64_t now = monotonicMs();
+    if (now >= nextTick)
+    {
+      m_EventServer.Tick();
+      m_RpcClient.Tick();
+      nextTick = now + TICK_INTERVAL_MS;
+      continue;
+    }
+
+    struct pollfd pfd = { m_WakeFd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, (int)(nextTick - now));
+    if (ready < 0 && errno != EINTR)
+      break;
+
+    uint64_t count;
+    if (ready > 0)
+      read(m_WakeFd, &count, sizeof(count));
+  }
+}
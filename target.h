@@ -0,0 +1,119 @@
+/*
+ * CEC anyway
+ *
+ * (C) by Magnus Kulke 2013 (mkulke at gmail dot com)
+ *
+ * This program is released and can be redistributed and/or modified
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __TARGET_H__
+#define __TARGET_H__
+
+#include "eventserver.h"
+#include "jsonrpc.h"
+#include "keytable.h"
+#include "latency.h"
+#include "notifier.h"
+#include "spscqueue.h"
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+// where an xbmc listens, a zero port means the default
+struct xbmc_endpoint
+{
+  std::string  host;
+  unsigned int rpcPort;
+  unsigned int eventPort;
+};
+
+/*
+ * One xbmc that key presses are sent to, with its own event server session,
+ * json-rpc connection and sender thread.
+ *
+ * Send() only copies the request into a lock-free ring buffer and wakes the
+ * sender, so every target is written to in parallel and a slow or dead xbmc
+ * holds up nothing but its own queue. If the sender falls QUEUE_SIZE
+ * requests behind, further requests are dropped. The sender also keeps the
+ * connections alive, every TICK_INTERVAL_MS.
+ */
+class CXbmcTarget : public CAlignedAlloc
+{
+public:
+  CXbmcTarget(const xbmc_endpoint &Endpoint);
+  ~CXbmcTarget();
+
+  // connects from the sender thread, so one target's timeout delays no other
+  bool Start();
+  void Stop();
+
+  // must only be called from one thread, return false if the queue is full
+  bool Send(const encoded_datagram *Datagrams, unsigned int Count);
+  bool Send(const char *Json, size_t Length);
+  bool Send(const std::string &Json) { return Send(Json.data(), Json.length()); }
+  // an OSD notification over the event server, Icon must outlive the target
+  bool Send(const notification &Note, const event_icon *Icon);
+
+  // host:port of the json-rpc server, for logs and metrics
+  const std::string &Name() const { return m_Name; }
+
+  CEventServerSession &EventServer() { return m_EventServer; }
+  CJsonRpcClient &RpcClient() { return m_RpcClient; }
+  const CJsonRpcClient &RpcClient() const { return m_RpcClient; }
+
+  unsigned int Dropped() const { return m_Dropped.load(std::memory_order_relaxed); }
+  // requests queued but not sent yet
+  unsigned int Backlog() const { return m_Posted.load(std::memory_order_acquire) - m_Done.load(std::memory_order_acquire); }
+
+  // time from queueing a request until it was sent, by transport
+  const CLatencyHistogram &Latency(key_action_type type) const { return m_Latency[type]; }
+
+  static const unsigned int QUEUE_SIZE = 64;
+  static const unsigned int MAX_DATAGRAMS = 8;   // four buttons
+  static const int TICK_INTERVAL_MS = 1000;
+
+private:
+  struct request
+  {
+    key_action_type   type;     // ACT_EVENTSERVER or ACT_JSONRPC
+    unsigned int      count;    // datagrams
+    encoded_datagram  datagrams[MAX_DATAGRAMS];
+    bool              notify;   // an event server notification instead
+    notification      note;
+    const event_icon *icon;
+    std::string       json;
+    int64_t           queued;   // monotonicNs()
+  };
+
+  bool Post();
+  void Run();
+
+  std::string                m_Name;
+  CEventServerSession        m_EventServer;
+  CJsonRpcClient             m_RpcClient;
+  CSpscQueue<request, QUEUE_SIZE> m_Queue;
+  request                    m_Request;   // producer side, keeps its json buffer
+  std::thread                m_Thread;
+  int                        m_WakeFd;
+  std::atomic<bool>          m_Stop;
+  std::atomic<unsigned int>  m_Posted;
+  std::atomic<unsigned int>  m_Done;
+  std::atomic<unsigned int>  m_Dropped;
+  CLatencyHistogram          m_Latency[ACT_TYPES];
+};
+
+#endif